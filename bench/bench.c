@@ -0,0 +1,478 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Microbenchmarks of the spectrogram hot paths, built by `make bench`.
+ *
+ * Every stage runs over a matrix of synthetic signals, FFT sizes, column
+ * heights and frequency scales:
+ *   push    audio callback: downmix and copy one hop into the STFT rings
+ *   fft     window, transform and power spectrum of one column
+ *   fft-mr  the same in multi-resolution mode, crossovers at 500 and 4000 Hz
+ *   fft-lf  the same limited to 0-2000 Hz, with a decimating front end
+ *   raster  power spectrum -> one column of pixels
+ *   blit    the ring surface painted in two parts with cairo, as the widget
+ *           does every frame
+ * Results go to stdout and, with --json, to a file for comparing builds.
+ * The bandwidth is computed from the bytes each stage has to touch at least,
+ * the real traffic is higher. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <cairo.h>
+
+#include "../kernels.h"
+#include "../raster.h"
+#include "../stft.h"
+
+#define MAX_LIST 16
+// same as the plugin's
+#define MAX_FFT 65536
+// input frames of every signal, played in a loop
+#define SIGNAL_FRAMES (1 << 20)
+#define SIGNAL_CHANNELS 2
+#define SAMPLERATE 44100.f
+// hops pushed before they are pulled in the fft stage, must fit the rings
+#define BATCH 32
+// spectra of the fft stage that the raster stage cycles through
+#define RASTER_COLUMNS 64
+// band edges of the fft-mr stage
+#define CROSSOVER_LOW 500.f
+#define CROSSOVER_HIGH 4000.f
+// upper limit of the fft-lf stage
+#define LF_MAX_FREQ 2000.f
+
+enum {
+    SIGNAL_SWEEP = 0,
+    SIGNAL_NOISE = 1,
+    SIGNAL_SILENCE = 2,
+};
+
+static const char *signal_names[] = { "sweep", "noise", "silence" };
+
+// STFT modes of the fft stages
+enum {
+    FFT_PLAIN = 0,
+    FFT_MULTIRES = 1,
+    FFT_LF = 2,
+};
+
+static const char *fft_stage_names[] = { "fft", "fft-mr", "fft-lf" };
+// RASTER_SCALE_*, short for the command line and the table, long for JSON
+static const char *scale_names[] = { "lin", "log", "mel", "bark" };
+static const char *scale_json_names[] = { "linear", "log", "mel", "bark" };
+
+typedef struct {
+    int fft_sizes[MAX_LIST];
+    int num_fft_sizes;
+    int heights[MAX_LIST];
+    int num_heights;
+    int scales[MAX_LIST];
+    int num_scales;
+    int signals[MAX_LIST];
+    int num_signals;
+    int hop;
+    int columns;
+    int width;
+    const char *json;
+} bench_config_t;
+
+typedef struct {
+    FILE *json;
+    int results;
+} bench_output_t;
+
+static double
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// parse a comma separated list of numbers or names (names index into
+// names[], numbers are taken as they are)
+static int
+parse_list (const char *arg, int *list, const char **names, int num_names)
+{
+    int n = 0;
+    char buf[256];
+    snprintf (buf, sizeof (buf), "%s", arg);
+    for (char *tok = strtok (buf, ","); tok && n < MAX_LIST; tok = strtok (NULL, ",")) {
+        if (names) {
+            int found = -1;
+            for (int i = 0; i < num_names; i++) {
+                if (!strcmp (tok, names[i])) {
+                    found = i;
+                }
+            }
+            if (found < 0) {
+                fprintf (stderr, "bench: unknown value '%s'\n", tok);
+                exit (1);
+            }
+            list[n++] = found;
+        }
+        else {
+            list[n++] = atoi (tok);
+        }
+    }
+    return n;
+}
+
+static float *
+make_signal (int type)
+{
+    float *pcm = malloc (sizeof (float) * SIGNAL_FRAMES * SIGNAL_CHANNELS);
+    if (!pcm) {
+        return NULL;
+    }
+    // exponential sweep from 20 Hz to 20 kHz over the whole buffer
+    double f0 = 20, f1 = 20000;
+    double duration = SIGNAL_FRAMES / SAMPLERATE;
+    double k = log (f1/f0);
+    uint32_t rnd = 0x12345678;
+    for (int i = 0; i < SIGNAL_FRAMES; i++) {
+        float v = 0;
+        if (type == SIGNAL_SWEEP) {
+            double t = i / SAMPLERATE;
+            v = 0.5 * sin (2 * M_PI * f0 * duration / k * (exp (t/duration * k) - 1));
+        }
+        else if (type == SIGNAL_NOISE) {
+            // xorshift32
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 17;
+            rnd ^= rnd << 5;
+            v = rnd / 2147483648.f - 1.f;
+        }
+        for (int c = 0; c < SIGNAL_CHANNELS; c++) {
+            pcm[i * SIGNAL_CHANNELS + c] = v;
+        }
+    }
+    return pcm;
+}
+
+static void
+report (bench_output_t *out, const char *stage, const char *unit, const char *signal, int fft_size, int height, int scale, double ns, double bytes)
+{
+    char fft[16] = "-", rows[16] = "-";
+    if (fft_size > 0) {
+        snprintf (fft, sizeof (fft), "%d", fft_size);
+    }
+    if (height > 0) {
+        snprintf (rows, sizeof (rows), "%d", height);
+    }
+    printf ("%-7s %-8s fft %6s  height %5s  %-4s  %12.1f ns/%-6s %12.0f %s/s %8.2f GB/s\n",
+            stage, signal ? signal : "-", fft, rows, scale < 0 ? "-" : scale_names[scale],
+            ns, unit, 1e9 / ns, unit, bytes / ns);
+    if (!out->json) {
+        return;
+    }
+    fprintf (out->json, "%s\n    {\"stage\": \"%s\", \"unit\": \"%s\"", out->results++ ? "," : "", stage, unit);
+    if (signal) {
+        fprintf (out->json, ", \"signal\": \"%s\"", signal);
+    }
+    if (fft_size > 0) {
+        fprintf (out->json, ", \"fft_size\": %d", fft_size);
+    }
+    if (height > 0) {
+        fprintf (out->json, ", \"height\": %d", height);
+    }
+    if (scale >= 0) {
+        fprintf (out->json, ", \"scale\": \"%s\"", scale_json_names[scale]);
+    }
+    fprintf (out->json, ", \"ns_per_%s\": %.2f, \"%ss_per_s\": %.1f, \"bytes_per_%s\": %.0f, \"gb_per_s\": %.3f}",
+            unit, ns, unit, 1e9 / ns, unit, bytes, bytes / ns);
+}
+
+static void
+bench_push (bench_output_t *out, bench_config_t *cfg, const float *pcm, const char *signal)
+{
+    stft_t *s = stft_new (2 * MAX_FFT);
+    if (!s) {
+        return;
+    }
+    stft_mix_t mix = { .mode = CHANNELS_MIX, .downmix = DOWNMIX_MEAN, .channel = 0 };
+    int hop = cfg->hop;
+    int pos = 0;
+    double t0 = now_ns ();
+    for (int c = 0; c < cfg->columns; c++) {
+        stft_push (s, pcm + pos * SIGNAL_CHANNELS, hop, SIGNAL_CHANNELS, &mix);
+        pos = (pos + hop) % (SIGNAL_FRAMES - hop);
+    }
+    double ns = (now_ns () - t0) / cfg->columns;
+    double bytes = hop * (SIGNAL_CHANNELS * sizeof (float) + sizeof (sample_t));
+    report (out, "push", "column", signal, 0, 0, -1, ns, bytes);
+    stft_free (s);
+}
+
+// also keeps some of the spectra for the raster stage unless spectra is NULL
+static void
+bench_fft (bench_output_t *out, bench_config_t *cfg, const float *pcm, const char *signal, int fft_size, int mode, sample_t *spectra)
+{
+    static const float crossovers[] = { CROSSOVER_LOW, CROSSOVER_HIGH };
+    // room for a whole batch on top of the largest window
+    stft_t *s = stft_new (2 * MAX_FFT);
+    if (!s || stft_configure (s, fft_size, 1, FFTW_MEASURE) < 0
+            || (mode == FFT_MULTIRES && stft_set_bands (s, SAMPLERATE, crossovers, 2, 0) < 0)
+            || (mode == FFT_LF && stft_set_bands (s, SAMPLERATE, NULL, 0, LF_MAX_FREQ) < 0)) {
+        fprintf (stderr, "bench: no FFT plan for size %d\n", fft_size);
+        if (s) {
+            stft_free (s);
+        }
+        return;
+    }
+    stft_mix_t mix = { .mode = CHANNELS_MIX, .downmix = DOWNMIX_MEAN, .channel = 0 };
+    int hop = cfg->hop;
+    int bins = fft_size/2;
+    sample_t *column = simd_malloc (sizeof (sample_t) * bins);
+    int pos = 0;
+    // the first windows have to be there before the first column, the
+    // bands reach further back than fft_size
+    stft_push (s, pcm, 2 * fft_size, SIGNAL_CHANNELS, &mix);
+    while (stft_pull (s, hop)) {
+    }
+
+    double ns = 0;
+    int done = 0;
+    while (done < cfg->columns) {
+        for (int b = 0; b < BATCH; b++) {
+            stft_push (s, pcm + pos * SIGNAL_CHANNELS, hop, SIGNAL_CHANNELS, &mix);
+            pos = (pos + hop) % (SIGNAL_FRAMES - hop);
+        }
+        double t0 = now_ns ();
+        while (stft_pull (s, hop)) {
+            stft_get_column (s, column);
+            if (spectra && done < RASTER_COLUMNS) {
+                memcpy (spectra + (size_t)done * bins, column, sizeof (sample_t) * bins);
+            }
+            done++;
+        }
+        ns += now_ns () - t0;
+    }
+    ns /= done;
+    // ring copy, windowing, transform and power spectrum; the bands touch
+    // less, but the same figure keeps the stages comparable
+    double bytes = sizeof (sample_t) * (2.0 * fft_size + 3.0 * fft_size + 3.0 * fft_size + 1.5 * fft_size);
+    report (out, fft_stage_names[mode], "column", signal, fft_size, 0, -1, ns, bytes);
+    free (column);
+    stft_free (s);
+}
+
+static void
+bench_raster (bench_output_t *out, bench_config_t *cfg, const char *signal, int fft_size, const sample_t *spectra, int height, int scale)
+{
+    static const uint32_t gradient[] = { 0xff0000, 0xff8000, 0xffff00, 0x80ff78, 0x0094a0, 0x002064, 0x000000 };
+    raster_t *r = raster_new ();
+    uint32_t *pixels = malloc (sizeof (uint32_t) * height);
+    if (!r || !pixels) {
+        if (r) {
+            raster_free (r);
+        }
+        free (pixels);
+        return;
+    }
+    raster_set_gradient (r, gradient, 7);
+    raster_set_db_range (r, 70);
+    raster_set_geometry (r, height, fft_size, SAMPLERATE, scale);
+    int bins = fft_size/2;
+    // builds the colour table
+    raster_render_column (r, spectra, pixels + height - 1, -1);
+
+    double t0 = now_ns ();
+    for (int c = 0; c < cfg->columns; c++) {
+        raster_render_column (r, spectra + (size_t)(c % RASTER_COLUMNS) * bins, pixels + height - 1, -1);
+    }
+    double ns = (now_ns () - t0) / cfg->columns;
+    double bytes = bins * sizeof (sample_t) + height * sizeof (uint32_t);
+    report (out, "raster", "column", signal, fft_size, height, scale, ns, bytes);
+    free (pixels);
+    raster_free (r);
+}
+
+// the widget paints its ring of columns in two parts, split at the cursor,
+// see spectrogram_draw_live; an image surface of the same format stands in
+// for the window
+static void
+bench_blit (bench_output_t *out, bench_config_t *cfg, int height)
+{
+    int width = cfg->width;
+    cairo_surface_t *surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+    cairo_surface_t *screen = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *cr = cairo_create (screen);
+    if (cairo_surface_status (surf) != CAIRO_STATUS_SUCCESS || cairo_status (cr) != CAIRO_STATUS_SUCCESS) {
+        cairo_destroy (cr);
+        cairo_surface_destroy (screen);
+        cairo_surface_destroy (surf);
+        return;
+    }
+    int frames = cfg->columns / 10 + 1;
+    double t0 = now_ns ();
+    for (int f = 0; f < frames; f++) {
+        int cursor = f % width;
+        int split = width - cursor;
+        cairo_save (cr);
+        cairo_set_source_surface (cr, surf, -cursor, 0);
+        cairo_rectangle (cr, 0, 0, split, height);
+        cairo_fill (cr);
+        if (cursor > 0) {
+            cairo_set_source_surface (cr, surf, split, 0);
+            cairo_rectangle (cr, split, 0, cursor, height);
+            cairo_fill (cr);
+        }
+        cairo_restore (cr);
+    }
+    // finish any pending drawing before the clock stops
+    cairo_surface_flush (screen);
+    double ns = (now_ns () - t0) / frames;
+    report (out, "blit", "frame", NULL, 0, height, -1, ns, 2.0 * width * height * sizeof (uint32_t));
+    cairo_destroy (cr);
+    cairo_surface_destroy (screen);
+    cairo_surface_destroy (surf);
+}
+
+static void
+usage (void)
+{
+    fprintf (stderr,
+            "usage: bench [options]\n"
+            "  --fft LIST       FFT sizes (default 512,2048,8192,32768)\n"
+            "  --heights LIST   column heights, at most %d (default 256,1024,%d)\n"
+            "  --scales LIST    lin,log,mel,bark (default all)\n"
+            "  --signals LIST   sweep,noise,silence (default all)\n"
+            "  --hop N          samples per column (default 1024)\n"
+            "  --columns N      columns per measurement (default 2000)\n"
+            "  --width N        widget width for the blit (default 1000)\n"
+            "  --json FILE      write the results as JSON\n",
+            RASTER_MAX_HEIGHT, RASTER_MAX_HEIGHT);
+    exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+    bench_config_t cfg = {
+        .fft_sizes = { 512, 2048, 8192, 32768 },
+        .num_fft_sizes = 4,
+        .heights = { 256, 1024, RASTER_MAX_HEIGHT },
+        .num_heights = 3,
+        .scales = { RASTER_SCALE_LINEAR, RASTER_SCALE_LOG, RASTER_SCALE_MEL, RASTER_SCALE_BARK },
+        .num_scales = 4,
+        .signals = { SIGNAL_SWEEP, SIGNAL_NOISE, SIGNAL_SILENCE },
+        .num_signals = 3,
+        .hop = 1024,
+        .columns = 2000,
+        .width = 1000,
+    };
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (i + 1 >= argc) {
+            usage ();
+        }
+        const char *val = argv[++i];
+        if (!strcmp (arg, "--fft")) {
+            cfg.num_fft_sizes = parse_list (val, cfg.fft_sizes, NULL, 0);
+        }
+        else if (!strcmp (arg, "--heights")) {
+            cfg.num_heights = parse_list (val, cfg.heights, NULL, 0);
+        }
+        else if (!strcmp (arg, "--scales")) {
+            cfg.num_scales = parse_list (val, cfg.scales, scale_names, 4);
+        }
+        else if (!strcmp (arg, "--signals")) {
+            cfg.num_signals = parse_list (val, cfg.signals, signal_names, 3);
+        }
+        else if (!strcmp (arg, "--hop")) {
+            cfg.hop = atoi (val);
+        }
+        else if (!strcmp (arg, "--columns")) {
+            cfg.columns = atoi (val);
+        }
+        else if (!strcmp (arg, "--width")) {
+            cfg.width = atoi (val);
+        }
+        else if (!strcmp (arg, "--json")) {
+            cfg.json = val;
+        }
+        else {
+            usage ();
+        }
+    }
+    for (int i = 0; i < cfg.num_fft_sizes; i++) {
+        int n = cfg.fft_sizes[i];
+        if (n < 64 || n > MAX_FFT || (n & (n - 1))) {
+            fprintf (stderr, "bench: FFT sizes must be powers of two up to %d\n", MAX_FFT);
+            return 1;
+        }
+    }
+    for (int i = 0; i < cfg.num_heights; i++) {
+        cfg.heights[i] = cfg.heights[i] < 1 ? 1 : (cfg.heights[i] > RASTER_MAX_HEIGHT ? RASTER_MAX_HEIGHT : cfg.heights[i]);
+    }
+    if (cfg.hop < 1 || cfg.hop * BATCH > MAX_FFT || cfg.columns < 1 || cfg.width < 1) {
+        usage ();
+    }
+
+    kernels_init ();
+    bench_output_t out = { 0 };
+    if (cfg.json) {
+        out.json = fopen (cfg.json, "w");
+        if (!out.json) {
+            perror (cfg.json);
+            return 1;
+        }
+        fprintf (out.json, "{\n  \"kernels\": \"%s\",\n  \"sample_bytes\": %d,\n  \"hop\": %d,\n  \"columns\": %d,\n  \"width\": %d,\n  \"results\": [",
+                kernels.name, (int)sizeof (sample_t), cfg.hop, cfg.columns, cfg.width);
+    }
+    printf ("kernels: %s, %d byte samples, hop %d\n", kernels.name, (int)sizeof (sample_t), cfg.hop);
+
+    sample_t *spectra = simd_malloc (sizeof (sample_t) * MAX_FFT/2 * RASTER_COLUMNS);
+    for (int s = 0; s < cfg.num_signals; s++) {
+        const char *signal = signal_names[cfg.signals[s]];
+        float *pcm = make_signal (cfg.signals[s]);
+        if (!pcm || !spectra) {
+            fprintf (stderr, "bench: out of memory\n");
+            return 1;
+        }
+        bench_push (&out, &cfg, pcm, signal);
+        for (int f = 0; f < cfg.num_fft_sizes; f++) {
+            memset (spectra, 0, sizeof (sample_t) * MAX_FFT/2 * RASTER_COLUMNS);
+            bench_fft (&out, &cfg, pcm, signal, cfg.fft_sizes[f], FFT_PLAIN, spectra);
+            bench_fft (&out, &cfg, pcm, signal, cfg.fft_sizes[f], FFT_MULTIRES, NULL);
+            bench_fft (&out, &cfg, pcm, signal, cfg.fft_sizes[f], FFT_LF, NULL);
+            for (int h = 0; h < cfg.num_heights; h++) {
+                for (int l = 0; l < cfg.num_scales; l++) {
+                    bench_raster (&out, &cfg, signal, cfg.fft_sizes[f], spectra, cfg.heights[h], cfg.scales[l]);
+                }
+            }
+        }
+        free (pcm);
+    }
+    for (int h = 0; h < cfg.num_heights; h++) {
+        bench_blit (&out, &cfg, cfg.heights[h]);
+    }
+    free (spectra);
+
+    if (out.json) {
+        fprintf (out.json, "\n  ]\n}\n");
+        fclose (out.json);
+    }
+    return 0;
+}
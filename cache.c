@@ -0,0 +1,304 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC "DDBSPEC"
+#define CACHE_VERSION 2
+#define CACHE_SUFFIX ".spec"
+// written natively, a file from a machine with the other byte order
+// doesn't validate
+#define CACHE_BYTE_ORDER 0x01020304
+// the columns start at a multiple of this
+#define CACHE_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    int64_t mtime;
+    uint32_t fft_size;
+    uint32_t hop;
+    uint32_t columns;
+    float samplerate;
+    // the track's path follows the header
+    uint32_t path_len;
+    // offset of the columns in the file
+    uint32_t data_offset;
+    // of the columns
+    uint32_t checksum;
+} cache_header_t;
+
+struct cache_s {
+    void *map;
+    size_t size;
+    const cache_header_t *header;
+    const uint8_t *data;
+    int bins;
+};
+
+// FNV-1a
+static uint64_t
+cache_hash (uint64_t h, const void *data, size_t n)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint32_t
+cache_checksum (const uint8_t *data, size_t n)
+{
+    uint32_t h = 0x811c9dc5;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+// the file name only depends on the key, colliding keys overwrite each
+// other, which the key check on opening catches
+static void
+cache_file_name (char *name, size_t size, const char *dir, const cache_key_t *key)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = cache_hash (h, key->path, strlen (key->path));
+    h = cache_hash (h, &key->mtime, sizeof (key->mtime));
+    h = cache_hash (h, &key->fft_size, sizeof (key->fft_size));
+    h = cache_hash (h, &key->hop, sizeof (key->hop));
+    snprintf (name, size, "%s/%016llx" CACHE_SUFFIX, dir, (unsigned long long)h);
+}
+
+static size_t
+cache_data_offset (size_t path_len)
+{
+    size_t offset = sizeof (cache_header_t) + path_len;
+    return (offset + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1);
+}
+
+static int
+cache_valid (const void *map, size_t size, const cache_key_t *key)
+{
+    const cache_header_t *h = map;
+    if (size < sizeof (cache_header_t) || memcmp (h->magic, CACHE_MAGIC, sizeof (h->magic))
+            || h->byte_order != CACHE_BYTE_ORDER || h->version != CACHE_VERSION) {
+        return 0;
+    }
+    size_t path_len = strlen (key->path);
+    if (h->mtime != key->mtime || h->fft_size != (uint32_t)key->fft_size || h->hop != (uint32_t)key->hop
+            || h->columns == 0 || h->path_len != path_len || h->data_offset != cache_data_offset (path_len)) {
+        return 0;
+    }
+    size_t data_size = (size_t)h->columns * (h->fft_size/2);
+    if (size != h->data_offset + data_size || memcmp ((const char *)map + sizeof (cache_header_t), key->path, path_len)) {
+        return 0;
+    }
+    return cache_checksum ((const uint8_t *)map + h->data_offset, data_size) == h->checksum;
+}
+
+cache_t *
+cache_open (const char *dir, const cache_key_t *key)
+{
+    char name[PATH_MAX];
+    cache_file_name (name, sizeof (name), dir, key);
+    int fd = open (name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat (fd, &st) == 0 && st.st_size > 0) {
+        map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close (fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    if (!cache_valid (map, st.st_size, key)) {
+        munmap (map, st.st_size);
+        // stale or broken, don't let it take up space
+        unlink (name);
+        return NULL;
+    }
+    cache_t *c = calloc (1, sizeof (cache_t));
+    if (!c) {
+        munmap (map, st.st_size);
+        return NULL;
+    }
+    c->map = map;
+    c->size = st.st_size;
+    c->header = map;
+    c->data = (const uint8_t *)map + c->header->data_offset;
+    c->bins = c->header->fft_size/2;
+    // most recently used now
+    utimes (name, NULL);
+    return c;
+}
+
+void
+cache_close (cache_t *c)
+{
+    munmap (c->map, c->size);
+    free (c);
+}
+
+float
+cache_samplerate (cache_t *c)
+{
+    return c->header->samplerate;
+}
+
+int
+cache_columns (cache_t *c)
+{
+    return c->header->columns;
+}
+
+const uint8_t *
+cache_column (cache_t *c, int column)
+{
+    return c->data + (size_t)column * c->bins;
+}
+
+int
+cache_store (const char *dir, const cache_key_t *key, float samplerate, int columns, const uint8_t *data)
+{
+    size_t path_len = strlen (key->path);
+    size_t offset = cache_data_offset (path_len);
+    size_t data_size = (size_t)columns * (key->fft_size/2);
+    // the header, the path and the padding, the columns are written as
+    // they are
+    uint8_t *buf = calloc (1, offset);
+    if (!buf) {
+        return -1;
+    }
+    cache_header_t *h = (cache_header_t *)buf;
+    memcpy (h->magic, CACHE_MAGIC, sizeof (h->magic));
+    h->byte_order = CACHE_BYTE_ORDER;
+    h->version = CACHE_VERSION;
+    h->mtime = key->mtime;
+    h->fft_size = key->fft_size;
+    h->hop = key->hop;
+    h->columns = columns;
+    h->samplerate = samplerate;
+    h->path_len = path_len;
+    h->data_offset = offset;
+    h->checksum = cache_checksum (data, data_size);
+    memcpy (buf + sizeof (cache_header_t), key->path, path_len);
+
+    // written under a temporary name, so that nobody maps half a file
+    char name[PATH_MAX];
+    char tmp[PATH_MAX+16];
+    mkdir (dir, 0755);
+    cache_file_name (name, sizeof (name), dir, key);
+    static int serial;
+    snprintf (tmp, sizeof (tmp), "%s.%d.%d.tmp", name, (int)getpid (), __atomic_fetch_add (&serial, 1, __ATOMIC_RELAXED));
+    int res = -1;
+    FILE *f = fopen (tmp, "wb");
+    if (f) {
+        int ok = fwrite (buf, 1, offset, f) == offset && fwrite (data, 1, data_size, f) == data_size;
+        ok = fclose (f) == 0 && ok;
+        res = ok && rename (tmp, name) == 0 ? 0 : -1;
+        if (res < 0) {
+            remove (tmp);
+        }
+    }
+    free (buf);
+    return res;
+}
+
+typedef struct {
+    char name[NAME_MAX+1];
+    time_t used;
+    int64_t size;
+} cache_file_t;
+
+static int
+cache_file_cmp (const void *a, const void *b)
+{
+    const cache_file_t *x = a;
+    const cache_file_t *y = b;
+    return x->used < y->used ? -1 : (x->used > y->used ? 1 : 0);
+}
+
+void
+cache_evict (const char *dir, int64_t max_bytes)
+{
+    DIR *d = opendir (dir);
+    if (!d) {
+        return;
+    }
+    cache_file_t *files = NULL;
+    int num_files = 0;
+    int max_files = 0;
+    int64_t total = 0;
+    struct dirent *e;
+    while ((e = readdir (d))) {
+        size_t len = strlen (e->d_name);
+        size_t suffix = strlen (CACHE_SUFFIX);
+        if (len <= suffix || strcmp (e->d_name + len - suffix, CACHE_SUFFIX)) {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf (path, sizeof (path), "%s/%s", dir, e->d_name);
+        if (stat (path, &st) != 0) {
+            continue;
+        }
+        if (num_files == max_files) {
+            max_files = max_files ? max_files * 2 : 64;
+            cache_file_t *grown = realloc (files, sizeof (cache_file_t) * max_files);
+            if (!grown) {
+                break;
+            }
+            files = grown;
+        }
+        cache_file_t *f = &files[num_files++];
+        snprintf (f->name, sizeof (f->name), "%s", e->d_name);
+        f->used = st.st_mtime;
+        f->size = st.st_size;
+        total += st.st_size;
+    }
+    closedir (d);
+
+    qsort (files, num_files, sizeof (cache_file_t), cache_file_cmp);
+    for (int i = 0; i < num_files && total > max_bytes; i++) {
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/%s", dir, files[i].name);
+        if (unlink (path) == 0) {
+            total -= files[i].size;
+        }
+    }
+    free (files);
+}
@@ -0,0 +1,77 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stdint.h>
+
+#include "fft.h"
+
+/* On-disk cache of whole-track spectrograms (see offline.h), one file per
+ * track and analysis setup in a directory of its own.
+ *
+ * Entries are keyed by the track's path and modification time, the FFT
+ * size and the hop in samples between two columns, the number of columns
+ * follows from the track's length. Columns are stored quantised like the
+ * history (one byte per bin, see history.h) and are read straight from a
+ * read-only mapping of the file. Every entry carries its key and a checksum; an entry that
+ * doesn't match is deleted instead of used. The directory is kept below a
+ * size limit by deleting the least recently used entries, an entry counts
+ * as used when it's stored or opened. */
+typedef struct {
+    const char *path;
+    int64_t mtime;
+    int fft_size;
+    int hop;
+} cache_key_t;
+
+typedef struct cache_s cache_t;
+
+// the mapped entry for key, NULL if there is none (or it's invalid)
+cache_t *
+cache_open (const char *dir, const cache_key_t *key);
+
+void
+cache_close (cache_t *c);
+
+float
+cache_samplerate (cache_t *c);
+
+int
+cache_columns (cache_t *c);
+
+// quantised power spectrum of a column, fft_size/2 bytes
+const uint8_t *
+cache_column (cache_t *c, int column);
+
+// write an entry of the given number of columns, already quantised
+// (columns * fft_size/2 bytes). The directory is created if needed.
+// Returns 0 on success.
+int
+cache_store (const char *dir, const cache_key_t *key, float samplerate, int columns, const uint8_t *data);
+
+// delete the least recently used entries until the entries take at most
+// max_bytes
+void
+cache_evict (const char *dir, int64_t max_bytes);
+
+#endif
@@ -0,0 +1,472 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+/* Batch renderer: spectrogram images of whole audio files, built by
+ * `make cli`.
+ *
+ * Every file is analysed like the widget's whole-track mode (see
+ * overview.h): one column per pixel, the mono mix, the same window, dB
+ * mapping and gradient. Files are decoded with libsndfile (WAV, FLAC and
+ * whatever else it supports) in chunks, so memory doesn't grow with their
+ * length. The columns of all files are split into segments that a pool of
+ * threads picks up one after another; a segment seeks to its start and
+ * draws straight into the image, the thread that finishes the last segment
+ * of a file writes the PNG. Segments are handed out in file order and an
+ * image only exists while its file is being drawn, so about one image per
+ * thread is in memory however many files there are. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cairo.h>
+#include <sndfile.h>
+
+#include "../kernels.h"
+#include "../overview.h"
+#include "../raster.h"
+
+// same limits as the plugin's
+#define MIN_FFT_SIZE 512
+#define MAX_FFT_SIZE 65536
+#define MAX_THREADS 64
+// columns per work item, also the columns kept in memory per thread
+#define SEGMENT_COLUMNS 64
+// frames decoded per read
+#define READ_FRAMES 4096
+
+typedef struct {
+    int width;
+    int height;
+    int fft_size;
+    // RASTER_SCALE_*
+    int scale;
+    int db_range;
+    uint32_t colors[7];
+    int num_colors;
+    int threads;
+    const char *out_dir;
+} render_config_t;
+
+typedef struct {
+    const char *path;
+    int64_t frames;
+    int samplerate;
+    int channels;
+    // created by the first segment drawn and destroyed by the last, so only
+    // the files in progress hold an image
+    cairo_surface_t *surf;
+    // segments still to be drawn, the last one writes the image
+    int remaining;
+    int failed;
+} render_file_t;
+
+typedef struct {
+    int file;
+    int c0;
+    int c1;
+} render_segment_t;
+
+typedef struct {
+    render_config_t *cfg;
+    render_file_t *files;
+    render_segment_t *segments;
+    int num_segments;
+    int next_segment;
+    int errors;
+    // guards the creation of the surfaces
+    pthread_mutex_t lock;
+} render_job_t;
+
+// per thread state, kept as long as the segments are from the same file
+typedef struct {
+    int file;
+    SNDFILE *snd;
+    overview_t *overview;
+    raster_t *raster;
+    float *pcm;
+    sample_t *mono;
+    sample_t *spectra;
+} render_worker_t;
+
+static void
+render_worker_close (render_worker_t *wk)
+{
+    if (wk->snd) {
+        sf_close (wk->snd);
+        wk->snd = NULL;
+    }
+    if (wk->overview) {
+        overview_free (wk->overview);
+        wk->overview = NULL;
+    }
+    free (wk->pcm);
+    wk->pcm = NULL;
+    wk->file = -1;
+}
+
+static int
+render_worker_open (render_job_t *job, render_worker_t *wk, int file)
+{
+    render_config_t *cfg = job->cfg;
+    render_file_t *f = &job->files[file];
+    render_worker_close (wk);
+    SF_INFO info;
+    memset (&info, 0, sizeof (info));
+    wk->snd = sf_open (f->path, SFM_READ, &info);
+    if (!wk->snd) {
+        return -1;
+    }
+    wk->pcm = malloc (sizeof (float) * READ_FRAMES * f->channels);
+    wk->overview = overview_new (cfg->fft_size, cfg->width, f->frames, FFTW_ESTIMATE);
+    if (!wk->pcm || !wk->overview) {
+        render_worker_close (wk);
+        return -1;
+    }
+    raster_set_geometry (wk->raster, cfg->height, cfg->fft_size, f->samplerate, cfg->scale);
+    wk->file = file;
+    return 0;
+}
+
+// the file's image, created on first use
+static cairo_surface_t *
+render_file_surface (render_job_t *job, render_file_t *f)
+{
+    pthread_mutex_lock (&job->lock);
+    if (!f->surf) {
+        cairo_surface_t *surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24, job->cfg->width, job->cfg->height);
+        if (cairo_surface_status (surf) == CAIRO_STATUS_SUCCESS) {
+            cairo_surface_flush (surf);
+            f->surf = surf;
+        }
+        else {
+            cairo_surface_destroy (surf);
+        }
+    }
+    cairo_surface_t *surf = f->surf;
+    pthread_mutex_unlock (&job->lock);
+    return surf;
+}
+
+static void
+render_segment (render_job_t *job, render_worker_t *wk, const render_segment_t *seg, cairo_surface_t *surf)
+{
+    render_file_t *f = &job->files[seg->file];
+    int64_t pos = overview_begin (wk->overview, seg->c0, seg->c1);
+    int c = seg->c0;
+    // a failed seek or read leaves silence, like the end of the file
+    if (sf_seek (wk->snd, pos, SEEK_SET) >= 0) {
+        while (c < seg->c1) {
+            sf_count_t frames = sf_readf_float (wk->snd, wk->pcm, READ_FRAMES);
+            if (frames <= 0) {
+                break;
+            }
+            kernels.downmix (wk->mono, wk->pcm, (int)frames, f->channels, DOWNMIX_MEAN, 0);
+            c = overview_push (wk->overview, wk->mono, (int)frames, wk->spectra);
+        }
+    }
+    if (c < seg->c1) {
+        overview_end (wk->overview, wk->spectra);
+    }
+
+    // the image is stored top down, columns are drawn from the bottom
+    int bins = job->cfg->fft_size/2;
+    uint32_t *data = (uint32_t *)cairo_image_surface_get_data (surf);
+    ptrdiff_t stride = cairo_image_surface_get_stride (surf) / 4;
+    uint32_t *bottom = data + (raster_height (wk->raster) - 1) * stride;
+    for (c = seg->c0; c < seg->c1; c++) {
+        raster_render_column (wk->raster, wk->spectra + (size_t)(c - seg->c0) * bins, bottom + c, -stride);
+    }
+}
+
+// <input>.png next to the input, or in dir
+static char *
+render_output_path (const char *path, const char *dir)
+{
+    const char *name = path;
+    if (dir) {
+        const char *slash = strrchr (path, '/');
+        name = slash ? slash + 1 : path;
+    }
+    size_t len = (dir ? strlen (dir) + 1 : 0) + strlen (name) + 5;
+    char *out = malloc (len);
+    if (out) {
+        if (dir) {
+            snprintf (out, len, "%s/%s.png", dir, name);
+        }
+        else {
+            snprintf (out, len, "%s.png", name);
+        }
+    }
+    return out;
+}
+
+static void
+render_finish_file (render_job_t *job, render_file_t *f)
+{
+    char *out_path = render_output_path (f->path, job->cfg->out_dir);
+    cairo_surface_mark_dirty (f->surf);
+    if (!out_path || cairo_surface_write_to_png (f->surf, out_path) != CAIRO_STATUS_SUCCESS) {
+        fprintf (stderr, "spectrogram-render: can't write %s\n", out_path ? out_path : f->path);
+        __atomic_fetch_add (&job->errors, 1, __ATOMIC_RELAXED);
+    }
+    else {
+        printf ("%s -> %s\n", f->path, out_path);
+    }
+    free (out_path);
+    cairo_surface_destroy (f->surf);
+    f->surf = NULL;
+}
+
+static void *
+render_thread (void *ctx)
+{
+    render_job_t *job = ctx;
+    render_config_t *cfg = job->cfg;
+    render_worker_t wk;
+    memset (&wk, 0, sizeof (wk));
+    wk.file = -1;
+    wk.raster = raster_new ();
+    wk.mono = simd_malloc (sizeof (sample_t) * READ_FRAMES);
+    wk.spectra = simd_malloc (sizeof (sample_t) * cfg->fft_size/2 * SEGMENT_COLUMNS);
+    if (!wk.raster || !wk.mono || !wk.spectra) {
+        fprintf (stderr, "spectrogram-render: out of memory\n");
+        exit (1);
+    }
+    raster_set_gradient (wk.raster, cfg->colors, cfg->num_colors);
+    raster_set_db_range (wk.raster, cfg->db_range);
+
+    for (;;) {
+        int s = __atomic_fetch_add (&job->next_segment, 1, __ATOMIC_RELAXED);
+        if (s >= job->num_segments) {
+            break;
+        }
+        const render_segment_t *seg = &job->segments[s];
+        render_file_t *f = &job->files[seg->file];
+        if (wk.file != seg->file && render_worker_open (job, &wk, seg->file) < 0) {
+            if (!__atomic_exchange_n (&f->failed, 1, __ATOMIC_RELAXED)) {
+                fprintf (stderr, "spectrogram-render: can't decode %s\n", f->path);
+            }
+        }
+        if (wk.file == seg->file) {
+            cairo_surface_t *surf = render_file_surface (job, f);
+            if (surf) {
+                render_segment (job, &wk, seg, surf);
+            }
+            else if (!__atomic_exchange_n (&f->failed, 1, __ATOMIC_RELAXED)) {
+                fprintf (stderr, "spectrogram-render: out of memory for %s\n", f->path);
+            }
+        }
+        // the last one to finish a file sees everyone else's columns
+        if (__atomic_sub_fetch (&f->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+            if (__atomic_load_n (&f->failed, __ATOMIC_RELAXED) || !f->surf) {
+                __atomic_fetch_add (&job->errors, 1, __ATOMIC_RELAXED);
+                if (f->surf) {
+                    cairo_surface_destroy (f->surf);
+                    f->surf = NULL;
+                }
+            }
+            else {
+                render_finish_file (job, f);
+            }
+        }
+    }
+    render_worker_close (&wk);
+    raster_free (wk.raster);
+    free (wk.mono);
+    free (wk.spectra);
+    return NULL;
+}
+
+static int
+parse_colors (const char *arg, uint32_t *colors, int max)
+{
+    int n = 0;
+    while (*arg && n < max) {
+        char *end;
+        colors[n++] = (uint32_t)strtoul (*arg == '#' ? arg + 1 : arg, &end, 16) & 0xffffff;
+        if (*end != ',') {
+            break;
+        }
+        arg = end + 1;
+    }
+    return n;
+}
+
+static void
+usage (void)
+{
+    fprintf (stderr,
+            "usage: spectrogram-render [options] FILE...\n"
+            "  --width N        columns, one per pixel (default 1000)\n"
+            "  --height N       rows, at most %d (default 400)\n"
+            "  --fft N          FFT size, a power of two from %d to %d (default 8192)\n"
+            "  --scale S        lin, log, mel or bark frequency scale (default log)\n"
+            "  --db-range N     dynamic range in dB (default 70)\n"
+            "  --colors LIST    up to 7 hex colours from loud to silent\n"
+            "  --threads N      worker threads (default one per CPU)\n"
+            "  -o DIR           write the images to DIR instead of next to the input\n",
+            RASTER_MAX_HEIGHT, MIN_FFT_SIZE, MAX_FFT_SIZE);
+    exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+    render_config_t cfg = {
+        .width = 1000,
+        .height = 400,
+        .fft_size = 8192,
+        .scale = RASTER_SCALE_LOG,
+        .db_range = 70,
+        // the plugin's default gradient
+        .colors = { 0xff0000, 0xff8000, 0xffff00, 0x80ff78, 0x0094a0, 0x002064, 0x000000 },
+        .num_colors = 7,
+        .threads = (int)sysconf (_SC_NPROCESSORS_ONLN),
+    };
+    int first = argc;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-') {
+            first = i;
+            break;
+        }
+        if (i + 1 >= argc) {
+            usage ();
+        }
+        const char *val = argv[++i];
+        if (!strcmp (arg, "--width")) {
+            cfg.width = atoi (val);
+        }
+        else if (!strcmp (arg, "--height")) {
+            cfg.height = atoi (val);
+        }
+        else if (!strcmp (arg, "--fft")) {
+            cfg.fft_size = atoi (val);
+        }
+        else if (!strcmp (arg, "--scale")) {
+            static const char *scales[] = { "lin", "log", "mel", "bark" };
+            cfg.scale = -1;
+            for (int s = 0; s < 4; s++) {
+                if (!strcmp (val, scales[s])) {
+                    cfg.scale = s;
+                }
+            }
+            if (cfg.scale < 0) {
+                usage ();
+            }
+        }
+        else if (!strcmp (arg, "--db-range")) {
+            cfg.db_range = atoi (val);
+        }
+        else if (!strcmp (arg, "--colors")) {
+            cfg.num_colors = parse_colors (val, cfg.colors, 7);
+        }
+        else if (!strcmp (arg, "--threads")) {
+            cfg.threads = atoi (val);
+        }
+        else if (!strcmp (arg, "-o")) {
+            cfg.out_dir = val;
+        }
+        else {
+            usage ();
+        }
+    }
+    int n = cfg.fft_size;
+    if (n < MIN_FFT_SIZE || n > MAX_FFT_SIZE || (n & (n - 1))) {
+        fprintf (stderr, "spectrogram-render: FFT sizes must be powers of two from %d to %d\n", MIN_FFT_SIZE, MAX_FFT_SIZE);
+        return 1;
+    }
+    if (first >= argc || cfg.width < 1 || cfg.height < 1 || cfg.height > RASTER_MAX_HEIGHT
+            || cfg.db_range < 1 || cfg.num_colors < 1) {
+        usage ();
+    }
+    cfg.threads = cfg.threads < 1 ? 1 : (cfg.threads > MAX_THREADS ? MAX_THREADS : cfg.threads);
+
+    kernels_init ();
+    int num_files = argc - first;
+    int segments_per_file = (cfg.width + SEGMENT_COLUMNS - 1) / SEGMENT_COLUMNS;
+    render_job_t job = {
+        .cfg = &cfg,
+        .files = calloc (num_files, sizeof (render_file_t)),
+        .segments = calloc ((size_t)num_files * segments_per_file, sizeof (render_segment_t)),
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    if (!job.files || !job.segments) {
+        fprintf (stderr, "spectrogram-render: out of memory\n");
+        return 1;
+    }
+
+    // the length of every file decides its column spans, so look at them
+    // all first; files that can't be opened are skipped
+    for (int i = 0; i < num_files; i++) {
+        render_file_t *f = &job.files[i];
+        f->path = argv[first + i];
+        SF_INFO info;
+        memset (&info, 0, sizeof (info));
+        SNDFILE *snd = sf_open (f->path, SFM_READ, &info);
+        if (!snd) {
+            fprintf (stderr, "spectrogram-render: %s: %s\n", f->path, sf_strerror (NULL));
+            job.errors++;
+            continue;
+        }
+        sf_close (snd);
+        if (info.frames <= 0 || info.channels < 1) {
+            fprintf (stderr, "spectrogram-render: %s has no known length\n", f->path);
+            job.errors++;
+            continue;
+        }
+        f->frames = info.frames;
+        f->samplerate = info.samplerate;
+        f->channels = info.channels;
+        f->remaining = segments_per_file;
+        for (int s = 0; s < segments_per_file; s++) {
+            render_segment_t *seg = &job.segments[job.num_segments++];
+            seg->file = i;
+            seg->c0 = s * SEGMENT_COLUMNS;
+            seg->c1 = seg->c0 + SEGMENT_COLUMNS < cfg.width ? seg->c0 + SEGMENT_COLUMNS : cfg.width;
+        }
+    }
+
+    if (cfg.threads > job.num_segments) {
+        cfg.threads = job.num_segments > 0 ? job.num_segments : 1;
+    }
+    pthread_t tid[MAX_THREADS];
+    int started = 0;
+    for (int t = 0; t < cfg.threads; t++) {
+        if (pthread_create (&tid[t], NULL, render_thread, &job) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (!started) {
+        render_thread (&job);
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join (tid[t], NULL);
+    }
+
+    pthread_mutex_destroy (&job.lock);
+    free (job.files);
+    free (job.segments);
+    return job.errors ? 1 : 0;
+}
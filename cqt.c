@@ -0,0 +1,189 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "cqt.h"
+
+struct cqt_s {
+    int bins;
+    // kernel of bin k: (index[i], weight[i]) for offset[k] <= i < offset[k+1]
+    int *offset;
+    int *index;
+    FFTW(complex) *weight;
+};
+
+void
+cqt_free (cqt_t *c)
+{
+    free (c->offset);
+    free (c->index);
+    free (c->weight);
+    free (c);
+}
+
+// append the significant values of spectrum (n values) to the kernels
+static int
+cqt_add_kernel (cqt_t *c, int k, const FFTW(complex) *spectrum, int n, int fft_size, int *capacity)
+{
+    double peak = 0;
+    for (int j = 0; j < n; j++) {
+        double m = spectrum[j][0] * spectrum[j][0] + spectrum[j][1] * spectrum[j][1];
+        peak = m > peak ? m : peak;
+    }
+    double threshold = peak * CQT_THRESHOLD * CQT_THRESHOLD;
+    int size = c->offset[k];
+    for (int j = 0; j < n; j++) {
+        double re = spectrum[j][0];
+        double im = spectrum[j][1];
+        if (re * re + im * im < threshold || peak == 0) {
+            continue;
+        }
+        if (size == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 1024;
+            int *index = realloc (c->index, sizeof (int) * *capacity);
+            if (index) {
+                c->index = index;
+            }
+            FFTW(complex) *weight = realloc (c->weight, sizeof (FFTW(complex)) * *capacity);
+            if (weight) {
+                c->weight = weight;
+            }
+            if (!index || !weight) {
+                return -1;
+            }
+        }
+        // conjugated and scaled for the inner product
+        c->index[size] = j;
+        c->weight[size][0] = re / fft_size;
+        c->weight[size][1] = -im / fft_size;
+        size++;
+    }
+    c->offset[k+1] = size;
+    return 0;
+}
+
+cqt_t *
+cqt_new (int fft_size, float samplerate, int bins_per_octave)
+{
+    cqt_t *c = calloc (1, sizeof (cqt_t));
+    if (!c) {
+        return NULL;
+    }
+    double q = 1 / (pow (2, 1.0 / bins_per_octave) - 1);
+    double nyquist = samplerate / 2;
+    int bins = (int)floor (bins_per_octave * log2 (nyquist / CQT_MIN_FREQ));
+    bins = bins < 1 ? 1 : (bins > fft_size/2 ? fft_size/2 : bins);
+    c->bins = bins;
+    c->offset = calloc (bins + 1, sizeof (int));
+
+    // the real and imaginary part of each temporal kernel are transformed
+    // separately, both are real
+    int n = fft_size/2 + 1;
+    sample_t *re = simd_malloc (sizeof (sample_t) * fft_size);
+    sample_t *im = simd_malloc (sizeof (sample_t) * fft_size);
+    sample_t *window = simd_malloc (sizeof (sample_t) * fft_size);
+    FFTW(complex) *re_out = simd_malloc (sizeof (FFTW(complex)) * n);
+    FFTW(complex) *im_out = simd_malloc (sizeof (FFTW(complex)) * n);
+    FFTW(complex) *kernel = malloc (sizeof (FFTW(complex)) * n);
+    FFTW(plan) plan_re = NULL;
+    FFTW(plan) plan_im = NULL;
+    if (re && im && window && re_out && im_out && kernel) {
+        plan_re = fft_plan_r2c (fft_size, re, re_out, FFTW_ESTIMATE);
+        plan_im = fft_plan_r2c (fft_size, im, im_out, FFTW_ESTIMATE);
+    }
+    int res = c->offset && plan_re && plan_im ? 0 : -1;
+    int capacity = 0;
+
+    for (int k = 0; k < bins && res == 0; k++) {
+        double freq = CQT_MIN_FREQ * pow (2, (double)k / bins_per_octave);
+        int len = (int)ceil (q * samplerate / freq);
+        len = len > fft_size ? fft_size : len;
+        int start = (fft_size - len) / 2;
+        fft_window_blackman_harris (window, len);
+        for (int i = 0; i < fft_size; i++) {
+            re[i] = im[i] = 0;
+        }
+        // scaled by fft_size/len, so that a sine comes out at the level of
+        // the windowed FFT
+        double scale = (double)fft_size / len;
+        for (int i = 0; i < len; i++) {
+            double phase = 2 * M_PI * freq * (i - len/2) / samplerate;
+            re[start+i] = window[i] * scale * cos (phase);
+            im[start+i] = window[i] * scale * sin (phase);
+        }
+        FFTW(execute) (plan_re);
+        FFTW(execute) (plan_im);
+        // FFT (re + i*im) = RE + i*IM
+        for (int j = 0; j < n; j++) {
+            kernel[j][0] = re_out[j][0] - im_out[j][1];
+            kernel[j][1] = re_out[j][1] + im_out[j][0];
+        }
+        res = cqt_add_kernel (c, k, kernel, n, fft_size, &capacity);
+    }
+
+    if (plan_re) {
+        fft_destroy_plan (plan_re);
+    }
+    if (plan_im) {
+        fft_destroy_plan (plan_im);
+    }
+    free (re);
+    free (im);
+    free (window);
+    free (re_out);
+    free (im_out);
+    free (kernel);
+    if (res < 0) {
+        cqt_free (c);
+        return NULL;
+    }
+    return c;
+}
+
+int
+cqt_bins (cqt_t *c)
+{
+    return c->bins;
+}
+
+int
+cqt_size (cqt_t *c)
+{
+    return c->offset[c->bins];
+}
+
+void
+cqt_transform (cqt_t *c, const FFTW(complex) *spectrum, sample_t *power)
+{
+    for (int k = 0; k < c->bins; k++) {
+        sample_t re = 0;
+        sample_t im = 0;
+        for (int i = c->offset[k]; i < c->offset[k+1]; i++) {
+            const sample_t *x = spectrum[c->index[i]];
+            const sample_t *w = c->weight[i];
+            re += x[0] * w[0] - x[1] * w[1];
+            im += x[0] * w[1] + x[1] * w[0];
+        }
+        power[k] = re * re + im * im;
+    }
+}
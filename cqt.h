@@ -0,0 +1,64 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef __CQT_H
+#define __CQT_H
+
+#include "fft.h"
+
+// lowest centre frequency, the bottom of the log scale
+#define CQT_MIN_FREQ 25.f
+// kernel values below this fraction of a kernel's peak are dropped
+#define CQT_THRESHOLD 0.005f
+
+/* Constant-Q transform on top of one FFT (Brown and Puckette, 1992).
+ *
+ * Bin k is centred at CQT_MIN_FREQ * 2^(k/bins_per_octave), up to the
+ * Nyquist frequency, and analyses a Blackman-Harris windowed stretch of
+ * Q periods of its frequency, centred in the FFT window. Where that would
+ * be longer than the FFT window, at the bottom, the whole window is used
+ * and the resolution there is the FFT's.
+ *
+ * The spectral kernels (the FFTs of those windowed sinusoids) are computed
+ * once and only their significant values are kept, so every bin is a short
+ * sparse dot product with the FFT of an unwindowed frame. The powers come
+ * out at the same level as the windowed FFT's. */
+typedef struct cqt_s cqt_t;
+
+cqt_t *
+cqt_new (int fft_size, float samplerate, int bins_per_octave);
+
+void
+cqt_free (cqt_t *c);
+
+// number of bins, at most fft_size/2
+int
+cqt_bins (cqt_t *c);
+
+// kernel values kept, i.e. complex multiplies per transform
+int
+cqt_size (cqt_t *c);
+
+// power of every bin from fft_size/2+1 values of an unwindowed r2c FFT
+void
+cqt_transform (cqt_t *c, const FFTW(complex) *spectrum, sample_t *power);
+
+#endif
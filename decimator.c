@@ -0,0 +1,104 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "decimator.h"
+
+struct decimator_s {
+    int factor;
+    int taps;
+    sample_t *h;
+};
+
+decimator_t *
+decimator_new (int factor)
+{
+    decimator_t *d = calloc (1, sizeof (decimator_t));
+    if (!d) {
+        return NULL;
+    }
+    d->factor = factor < 1 ? 1 : factor;
+    d->taps = DECIMATOR_TAPS_PER_PHASE * d->factor;
+    d->h = simd_malloc (sizeof (sample_t) * d->taps);
+    sample_t *window = simd_malloc (sizeof (sample_t) * (d->taps + 1));
+    if (!d->h || !window) {
+        free (window);
+        decimator_free (d);
+        return NULL;
+    }
+    // symmetric window of taps points, the periodic one is a point longer
+    fft_window_blackman_harris (window, d->taps + 1);
+    double cutoff = 0.5 / d->factor;
+    double centre = (d->taps - 1) / 2.0;
+    double sum = 0;
+    for (int i = 0; i < d->taps; i++) {
+        double x = i - centre;
+        double sinc = x == 0 ? 1 : sin (2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+        d->h[i] = window[i+1] * sinc;
+        sum += d->h[i];
+    }
+    // unity gain at DC
+    for (int i = 0; i < d->taps; i++) {
+        d->h[i] /= sum;
+    }
+    free (window);
+    return d;
+}
+
+void
+decimator_free (decimator_t *d)
+{
+    free (d->h);
+    free (d);
+}
+
+int
+decimator_factor (decimator_t *d)
+{
+    return d->factor;
+}
+
+int
+decimator_taps (decimator_t *d)
+{
+    return d->taps;
+}
+
+void
+decimator_run (decimator_t *d, const sample_t *in, sample_t *out, int n)
+{
+    const sample_t *h = d->h;
+    int taps = d->taps;
+    for (int i = 0; i < n; i++) {
+        const sample_t *x = in + (size_t)i * d->factor;
+        // independent sums, so that the compiler can vectorize the loop
+        sample_t acc[4] = { 0, 0, 0, 0 };
+        for (int t = 0; t < taps; t += 4) {
+            acc[0] += h[t] * x[t];
+            acc[1] += h[t+1] * x[t+1];
+            acc[2] += h[t+2] * x[t+2];
+            acc[3] += h[t+3] * x[t+3];
+        }
+        out[i] = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    }
+}
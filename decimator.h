@@ -0,0 +1,61 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef __DECIMATOR_H
+#define __DECIMATOR_H
+
+#include "fft.h"
+
+// filter length per output sample and unit of decimation
+#define DECIMATOR_TAPS_PER_PHASE 40
+// fraction of the decimated Nyquist frequency that is passed unharmed,
+// aliases of everything below it are at least 90 dB down
+#define DECIMATOR_PASSBAND 0.8f
+
+/* Anti-alias filter and downsampler by an integer factor.
+ *
+ * A Blackman-Harris windowed sinc low pass with its transition band
+ * centred on the new Nyquist frequency. Only every factor-th output is
+ * computed, which is the polyphase form of the filter: each output costs
+ * DECIMATOR_TAPS_PER_PHASE multiplies per unit of factor, whatever the
+ * factor. The filter is linear phase, its delay is decimator_taps/2 input
+ * samples. It keeps no state, the caller passes the input history. */
+typedef struct decimator_s decimator_t;
+
+decimator_t *
+decimator_new (int factor);
+
+void
+decimator_free (decimator_t *d);
+
+int
+decimator_factor (decimator_t *d);
+
+// filter length in input samples
+int
+decimator_taps (decimator_t *d);
+
+// n outputs from (n-1)*factor + taps inputs, output i is the filtered
+// signal at the end of in[i*factor .. i*factor+taps)
+void
+decimator_run (decimator_t *d, const sample_t *in, sample_t *out, int n);
+
+#endif
@@ -0,0 +1,108 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "fft.h"
+
+static pthread_mutex_t planner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char wisdom_path[PATH_MAX];
+static int wisdom_loaded = 0;
+
+void
+fft_set_wisdom_file (const char *dir)
+{
+    pthread_mutex_lock (&planner_mutex);
+    if (dir) {
+        snprintf (wisdom_path, sizeof (wisdom_path), "%s/%s", dir, FFT_WISDOM_FILE);
+    }
+    else {
+        wisdom_path[0] = 0;
+    }
+    wisdom_loaded = 0;
+    pthread_mutex_unlock (&planner_mutex);
+}
+
+static void
+fft_save_wisdom (void)
+{
+    if (!wisdom_path[0]) {
+        return;
+    }
+    // write a temporary file first, a half written one would be ignored by
+    // FFTW but would also lose everything we had so far
+    char tmp[PATH_MAX+4];
+    snprintf (tmp, sizeof (tmp), "%s.tmp", wisdom_path);
+    if (FFTW(export_wisdom_to_filename) (tmp)) {
+        rename (tmp, wisdom_path);
+    }
+    else {
+        remove (tmp);
+    }
+}
+
+FFTW(plan)
+fft_plan_many_r2c (int n, int howmany, sample_t *in, FFTW(complex) *out, unsigned flags)
+{
+    pthread_mutex_lock (&planner_mutex);
+    if (!wisdom_loaded && wisdom_path[0]) {
+        FFTW(import_wisdom_from_filename) (wisdom_path);
+        wisdom_loaded = 1;
+    }
+    // transforms are packed back to back, n samples in and n/2+1 bins out.
+    // Estimated plans are cheap and add nothing worth saving, they only use
+    // the wisdom that is there.
+    FFTW(plan) p = FFTW(plan_many_dft_r2c) (1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n/2+1,
+            flags & FFTW_ESTIMATE ? flags : flags | FFTW_WISDOM_ONLY);
+    if (!p && !(flags & FFTW_ESTIMATE)) {
+        // first time we see this size, measure it and remember the result
+        p = FFTW(plan_many_dft_r2c) (1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n/2+1, flags);
+        if (p) {
+            fft_save_wisdom ();
+        }
+    }
+    pthread_mutex_unlock (&planner_mutex);
+    return p;
+}
+
+FFTW(plan)
+fft_plan_r2c (int n, sample_t *in, FFTW(complex) *out, unsigned flags)
+{
+    return fft_plan_many_r2c (n, 1, in, out, flags);
+}
+
+void
+fft_window_blackman_harris (sample_t *window, int n)
+{
+    for (int i = 0; i < n; i++) {
+        window[i] = 0.35875 - 0.48829 * cos(2 * M_PI * i /(n)) + 0.14128 * cos(4 * M_PI * i/(n)) - 0.01168 * cos(6 * M_PI * i/(n));
+    }
+}
+
+void
+fft_destroy_plan (FFTW(plan) p)
+{
+    pthread_mutex_lock (&planner_mutex);
+    FFTW(destroy_plan) (p);
+    pthread_mutex_unlock (&planner_mutex);
+}
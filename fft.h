@@ -0,0 +1,77 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __FFT_H
+#define __FFT_H
+
+#include <stdlib.h>
+#include <fftw3.h>
+
+/* Precision of the analysis pipeline, selected at build time (see the
+ * FFTW_PRECISION Makefile variable). The input is float PCM and the output
+ * an 8 bit colour index, so single precision is the default: it halves the
+ * memory traffic of every pass and doubles the SIMD width. */
+#ifdef USE_FFTW_DOUBLE
+typedef double sample_t;
+#define FFTW(name) fftw_ ## name
+#define FFT_WISDOM_FILE "spectrogram_fftw.wisdom"
+#else
+typedef float sample_t;
+#define FFTW(name) fftwf_ ## name
+#define FFT_WISDOM_FILE "spectrogram_fftwf.wisdom"
+#endif
+
+// wide enough for AVX-512 loads
+#define SIMD_ALIGNMENT 64
+
+static inline void *
+simd_malloc (size_t size)
+{
+    void *ptr = NULL;
+    if (posix_memalign (&ptr, SIMD_ALIGNMENT, size) != 0) {
+        return NULL;
+    }
+    return ptr;
+}
+
+// Blackman-Harris window of n samples
+void
+fft_window_blackman_harris (sample_t *window, int n);
+
+/* The FFTW planner isn't thread-safe, always create and destroy plans
+ * through these. Measured plans (flags is FFTW_MEASURE or stronger) add
+ * their wisdom to the wisdom file, so only the first plan for a given size
+ * takes long. FFTW_ESTIMATE plans, e.g. the constant-Q kernels' one-off
+ * transforms, use that wisdom but never write the file. */
+void
+fft_set_wisdom_file (const char *dir);
+
+FFTW(plan)
+fft_plan_r2c (int n, sample_t *in, FFTW(complex) *out, unsigned flags);
+
+// howmany transforms of n samples in one plan, input i starts at in + i*n,
+// output i at out + i*(n/2+1)
+FFTW(plan)
+fft_plan_many_r2c (int n, int howmany, sample_t *in, FFTW(complex) *out, unsigned flags);
+
+void
+fft_destroy_plan (FFTW(plan) p);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "filterbank.h"
+#include "kernels.h"
+
+struct filterbank_s {
+    int bands;
+    // weights of band k: weight[offset[k] + i] for bin start[k] + i, up to
+    // offset[k+1]
+    int *offset;
+    int *start;
+    float *weight;
+};
+
+static double
+filterbank_to_scale (int scale, double freq)
+{
+    if (scale == FILTERBANK_BARK) {
+        // Traunmüller
+        return 26.81 * freq / (1960 + freq) - 0.53;
+    }
+    return 2595 * log10 (1 + freq / 700);
+}
+
+static double
+filterbank_from_scale (int scale, double value)
+{
+    if (scale == FILTERBANK_BARK) {
+        return 1960 * (value + 0.53) / (26.28 - value);
+    }
+    return 700 * (pow (10, value / 2595) - 1);
+}
+
+void
+filterbank_free (filterbank_t *fb)
+{
+    free (fb->offset);
+    free (fb->start);
+    free (fb->weight);
+    free (fb);
+}
+
+filterbank_t *
+filterbank_new (int scale, int bands, int fft_size, float samplerate, float f_min, float f_max)
+{
+    filterbank_t *fb = calloc (1, sizeof (filterbank_t));
+    if (!fb) {
+        return NULL;
+    }
+    int bins = fft_size/2;
+    double bin_width = (double)samplerate / fft_size;
+    fb->bands = bands;
+    fb->offset = malloc (sizeof (int) * (bands + 1));
+    fb->start = malloc (sizeof (int) * bands);
+    // band edges, the centres of the neighbours
+    double *edge = malloc (sizeof (double) * (bands + 2));
+    if (!fb->offset || !fb->start || !edge) {
+        free (edge);
+        filterbank_free (fb);
+        return NULL;
+    }
+    double s0 = filterbank_to_scale (scale, f_min);
+    double s1 = filterbank_to_scale (scale, f_max);
+    for (int i = 0; i < bands + 2; i++) {
+        edge[i] = filterbank_from_scale (scale, s0 + (s1 - s0) * i / (bands + 1));
+    }
+
+    // a band covers at most the bins between its edges, plus two for the
+    // interpolated ones
+    int capacity = 0;
+    for (int k = 0; k < bands; k++) {
+        capacity += (int)((edge[k+2] - edge[k]) / bin_width) + 2;
+    }
+    fb->weight = malloc (sizeof (float) * capacity);
+    if (!fb->weight) {
+        free (edge);
+        filterbank_free (fb);
+        return NULL;
+    }
+
+    int size = 0;
+    for (int k = 0; k < bands; k++) {
+        double lo = edge[k];
+        double centre = edge[k+1];
+        double hi = edge[k+2];
+        fb->offset[k] = size;
+        if ((hi - lo) / 2 < bin_width) {
+            // narrower than a bin
+            double pos = centre / bin_width;
+            int j = (int)pos;
+            j = j > bins - 2 ? bins - 2 : j;
+            double w = pos - j;
+            w = w > 1 ? 1 : w;
+            fb->start[k] = j;
+            fb->weight[size++] = 1 - w;
+            fb->weight[size++] = w;
+            continue;
+        }
+        int j0 = (int)ceil (lo / bin_width);
+        int j1 = (int)floor (hi / bin_width);
+        j1 = j1 > bins - 1 ? bins - 1 : j1;
+        // only the bins on the edges can get 0, those are kept so that
+        // the weights stay consecutive
+        fb->start[k] = j0;
+        double sum = 0;
+        for (int j = j0; j <= j1 && size < capacity; j++) {
+            double f = j * bin_width;
+            double w = f <= centre ? (f - lo) / (centre - lo) : (hi - f) / (hi - centre);
+            w = w > 0 ? w : 0;
+            fb->weight[size++] = w;
+            sum += w;
+        }
+        for (int i = fb->offset[k]; i < size && sum > 0; i++) {
+            fb->weight[i] /= sum;
+        }
+    }
+    fb->offset[bands] = size;
+    free (edge);
+    return fb;
+}
+
+int
+filterbank_bands (filterbank_t *fb)
+{
+    return fb->bands;
+}
+
+int
+filterbank_size (filterbank_t *fb)
+{
+    return fb->offset[fb->bands];
+}
+
+void
+filterbank_apply (filterbank_t *fb, const sample_t *spectrum, float *energy)
+{
+    kernels.filterbank (energy, spectrum, fb->start, fb->offset, fb->weight, fb->bands);
+}
@@ -0,0 +1,63 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef __FILTERBANK_H
+#define __FILTERBANK_H
+
+#include "fft.h"
+
+// perceptual frequency scales
+enum {
+    FILTERBANK_MEL = 0,
+    FILTERBANK_BARK = 1,
+};
+
+/* Triangular filters spaced evenly on the mel or Bark scale.
+ *
+ * Every band's filter rises from the centre of the band below to its own
+ * centre and falls to the centre of the band above. The weights of a band
+ * add up to 1, so it shows the mean power of its bins and noise keeps the
+ * same level on every band; a sine in a band many bins wide is shown
+ * weaker accordingly. Bands narrower than an FFT bin interpolate linearly
+ * between the two bins around their centre instead. The weights of a band
+ * cover consecutive bins, so they are stored as one run per band, starting
+ * at the band's first bin; applying them to a power spectrum is a dot
+ * product per band (see kernels.h). */
+typedef struct filterbank_s filterbank_t;
+
+filterbank_t *
+filterbank_new (int scale, int bands, int fft_size, float samplerate, float f_min, float f_max);
+
+void
+filterbank_free (filterbank_t *fb);
+
+int
+filterbank_bands (filterbank_t *fb);
+
+// stored weights, i.e. multiplies per spectrum
+int
+filterbank_size (filterbank_t *fb);
+
+// band energies of fft_size/2 power values, lowest band first
+void
+filterbank_apply (filterbank_t *fb, const sample_t *spectrum, float *energy);
+
+#endif
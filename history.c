@@ -0,0 +1,151 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "kernels.h"
+#include "history.h"
+
+// values converted to dB at once
+#define HISTORY_BLOCK 1024
+
+struct history_s {
+    int values;
+    int capacity;
+    // capacity columns of values bytes, a ring
+    uint8_t *data;
+    // columns pushed so far
+    int64_t pushed;
+};
+
+// quantised value -> power
+static sample_t dequantize_lut[256];
+static pthread_once_t dequantize_once = PTHREAD_ONCE_INIT;
+
+static void
+history_init_lut (void)
+{
+    for (int q = 0; q < 256; q++) {
+        dequantize_lut[q] = (sample_t)pow (10, (HISTORY_DB_MIN + q * HISTORY_DB_STEP) / 10);
+    }
+}
+
+void
+history_quantize (uint8_t *dst, const sample_t *src, int n)
+{
+    float db[HISTORY_BLOCK];
+    for (int i = 0; i < n; i += HISTORY_BLOCK) {
+        int m = n - i < HISTORY_BLOCK ? n - i : HISTORY_BLOCK;
+        for (int j = 0; j < m; j++) {
+            db[j] = src[i+j];
+        }
+        kernels.db (db, db, m);
+        for (int j = 0; j < m; j++) {
+            // rounded to the nearest step, silence (-inf) ends up at 0
+            float x = (db[j] - HISTORY_DB_MIN) / HISTORY_DB_STEP + 0.5f;
+            dst[i+j] = x > 0 ? (x < 255 ? (uint8_t)x : 255) : 0;
+        }
+    }
+}
+
+void
+history_dequantize (sample_t *dst, const uint8_t *src, int n)
+{
+    pthread_once (&dequantize_once, history_init_lut);
+    for (int i = 0; i < n; i++) {
+        dst[i] = dequantize_lut[src[i]];
+    }
+}
+
+history_t *
+history_new (int values, int capacity)
+{
+    if (values < 1 || capacity < 1) {
+        return NULL;
+    }
+    history_t *h = calloc (1, sizeof (history_t));
+    if (!h) {
+        return NULL;
+    }
+    h->values = values;
+    h->capacity = capacity;
+    h->data = malloc ((size_t)values * capacity);
+    if (!h->data) {
+        free (h);
+        return NULL;
+    }
+    return h;
+}
+
+void
+history_free (history_t *h)
+{
+    free (h->data);
+    free (h);
+}
+
+void
+history_clear (history_t *h)
+{
+    h->pushed = 0;
+}
+
+int
+history_values (history_t *h)
+{
+    return h->values;
+}
+
+int
+history_capacity (history_t *h)
+{
+    return h->capacity;
+}
+
+int
+history_count (history_t *h)
+{
+    return h->pushed < h->capacity ? (int)h->pushed : h->capacity;
+}
+
+void
+history_push (history_t *h, const sample_t *column)
+{
+    history_quantize (h->data + (size_t)(h->pushed % h->capacity) * h->values, column, h->values);
+    h->pushed++;
+}
+
+void
+history_push_quantized (history_t *h, const uint8_t *column)
+{
+    memcpy (h->data + (size_t)(h->pushed % h->capacity) * h->values, column, h->values);
+    h->pushed++;
+}
+
+void
+history_get (history_t *h, int i, sample_t *column)
+{
+    int64_t oldest = h->pushed - history_count (h);
+    history_dequantize (column, h->data + (size_t)((oldest + i) % h->capacity) * h->values, h->values);
+}
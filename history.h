@@ -0,0 +1,86 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+
+#ifndef __HISTORY_H
+#define __HISTORY_H
+
+#include <stdint.h>
+
+#include "fft.h"
+#include "raster.h"
+
+// quantisation step of the stored power in dB
+#define HISTORY_DB_STEP 0.5f
+// everything below is stored as this, i.e. 255 steps under the loudest
+// colour of the raster; covers the largest dB range of the settings
+#define HISTORY_DB_MIN (RASTER_DB_MAX - 255 * HISTORY_DB_STEP)
+
+/* Scrollback of analysed columns.
+ *
+ * Every value of a column (all lanes' power spectra) is kept as one byte,
+ * its power in dB in HISTORY_DB_STEP steps, which is 1/4 or 1/8 of the
+ * memory of the spectra themselves. The newest capacity columns are kept,
+ * older ones are overwritten. Columns come out as power again, so they can
+ * be drawn by raster_render_column with whatever colours, dB range and
+ * geometry are current. Not thread safe. */
+typedef struct history_s history_t;
+
+// values per column, columns kept at most
+history_t *
+history_new (int values, int capacity);
+
+void
+history_free (history_t *h);
+
+void
+history_clear (history_t *h);
+
+int
+history_values (history_t *h);
+
+int
+history_capacity (history_t *h);
+
+// columns stored, at most the capacity
+int
+history_count (history_t *h);
+
+// store the newest column
+void
+history_push (history_t *h, const sample_t *column);
+
+// the same for a column that is quantised already, e.g. one of the whole
+// track cache (see cache.h)
+void
+history_push_quantized (history_t *h, const uint8_t *column);
+
+// column i, oldest first: 0 <= i < history_count
+void
+history_get (history_t *h, int i, sample_t *column);
+
+// the quantisation on its own, n power values to bytes and back
+void
+history_quantize (uint8_t *dst, const sample_t *src, int n);
+
+void
+history_dequantize (sample_t *dst, const uint8_t *src, int n);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fastftoi.h"
+#include "kernels.h"
+
+/* Scalar reference implementation */
+
+static void
+window_scalar (sample_t *buf, const sample_t *window, int n)
+{
+    for (int i = 0; i < n; i++) {
+        buf[i] *= window[i];
+    }
+}
+
+static void
+power_scalar (sample_t *dst, const FFTW(complex) *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = src[i][0] * src[i][0] + src[i][1] * src[i][1];
+    }
+}
+
+static void
+db_scalar (float *dst, const float *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = 10 * log10f (src[i]);
+    }
+}
+
+static inline int32_t
+color_index_1 (float x, float db_offset, float db_range, int table_size)
+{
+    x += db_offset;
+    x = x < 0 ? 0 : (x > db_range ? db_range : x);
+    int idx = table_size - ftoi (table_size/db_range * x);
+    return idx < 0 ? 0 : (idx > table_size - 1 ? table_size - 1 : idx);
+}
+
+static void
+color_index_scalar (int32_t *dst, const float *db, int n, float db_offset, float db_range, int table_size)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] = color_index_1 (db[i], db_offset, db_range, table_size);
+    }
+}
+
+static void
+downmix_scalar (sample_t *dst, const float *src, int n, int channels, int mode, int channel)
+{
+    if (channels < 2) {
+        for (int i = 0; i < n; i++) {
+            dst[i] = mode == DOWNMIX_SIDE ? 0 : src[i];
+        }
+        return;
+    }
+    switch (mode) {
+    case DOWNMIX_MID:
+        for (int i = 0; i < n; i++) {
+            dst[i] = (src[i * channels] + src[i * channels + 1]) * 0.5f;
+        }
+        break;
+    case DOWNMIX_SIDE:
+        for (int i = 0; i < n; i++) {
+            dst[i] = (src[i * channels] - src[i * channels + 1]) * 0.5f;
+        }
+        break;
+    case DOWNMIX_MAX_ABS:
+        for (int i = 0; i < n; i++) {
+            float value = src[i * channels];
+            for (int c = 1; c < channels; c++) {
+                if (fabsf (src[i * channels + c]) > fabsf (value)) {
+                    value = src[i * channels + c];
+                }
+            }
+            dst[i] = value;
+        }
+        break;
+    case DOWNMIX_CHANNEL:
+        channel = channel < channels ? channel : channels - 1;
+        for (int i = 0; i < n; i++) {
+            dst[i] = src[i * channels + channel];
+        }
+        break;
+    default: {
+        float scale = 1.f / channels;
+        for (int i = 0; i < n; i++) {
+            float sum = 0;
+            for (int c = 0; c < channels; c++) {
+                sum += src[i * channels + c];
+            }
+            dst[i] = sum * scale;
+        }
+        break;
+    }
+    }
+}
+
+static void
+filterbank_scalar (float *dst, const sample_t *src, const int *start, const int *offset, const float *weight, int rows)
+{
+    for (int k = 0; k < rows; k++) {
+        const float *w = weight + offset[k];
+        const sample_t *s = src + start[k];
+        float sum = 0;
+        for (int i = 0; i < offset[k+1] - offset[k]; i++) {
+            sum += w[i] * s[i];
+        }
+        dst[k] = sum;
+    }
+}
+
+static const kernels_t kernels_scalar = {
+    .name = "scalar",
+    .window = window_scalar,
+    .power = power_scalar,
+    .db = db_scalar,
+    .color_index = color_index_scalar,
+    .downmix = downmix_scalar,
+    .filterbank = filterbank_scalar,
+};
+
+/* SIMD implementations, x86 only for now */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_SIMD_KERNELS
+
+#define KERNEL_SUFFIX sse2
+#define KERNEL_TARGET "sse2"
+#define KERNEL_WIDTH 4
+#define KERNEL_EVEN {0, 2, 4, 6}
+#define KERNEL_ODD {1, 3, 5, 7}
+#include "kernels_template.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_WIDTH
+#undef KERNEL_EVEN
+#undef KERNEL_ODD
+
+#define KERNEL_SUFFIX avx2
+#define KERNEL_TARGET "avx2"
+#define KERNEL_WIDTH 8
+#define KERNEL_EVEN {0, 2, 4, 6, 8, 10, 12, 14}
+#define KERNEL_ODD {1, 3, 5, 7, 9, 11, 13, 15}
+#include "kernels_template.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_WIDTH
+#undef KERNEL_EVEN
+#undef KERNEL_ODD
+
+#define KERNEL_SUFFIX avx512
+#define KERNEL_TARGET "avx512f"
+#define KERNEL_WIDTH 16
+#define KERNEL_EVEN {0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30}
+#define KERNEL_ODD {1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31}
+// filterbank bands are mostly a few dozen bins at any offset, too short for
+// 16 floats a vector: the AVX2 version is about twice as fast
+#define KERNEL_FILTERBANK filterbank_avx2
+#include "kernels_template.h"
+#undef KERNEL_SUFFIX
+#undef KERNEL_TARGET
+#undef KERNEL_WIDTH
+#undef KERNEL_EVEN
+#undef KERNEL_ODD
+#undef KERNEL_FILTERBANK
+#endif
+
+kernels_t kernels = {
+    .name = "scalar",
+    .window = window_scalar,
+    .power = power_scalar,
+    .db = db_scalar,
+    .color_index = color_index_scalar,
+    .downmix = downmix_scalar,
+    .filterbank = filterbank_scalar,
+};
+
+int
+kernels_get_available (const kernels_t **list, int max)
+{
+    int n = 0;
+    if (n < max) {
+        list[n++] = &kernels_scalar;
+    }
+#ifdef HAVE_SIMD_KERNELS
+    __builtin_cpu_init ();
+    if (n < max && __builtin_cpu_supports ("sse2")) {
+        list[n++] = &kernels_sse2;
+    }
+    if (n < max && __builtin_cpu_supports ("avx2")) {
+        list[n++] = &kernels_avx2;
+    }
+    if (n < max && __builtin_cpu_supports ("avx512f")) {
+        list[n++] = &kernels_avx512;
+    }
+#endif
+    return n;
+}
+
+void
+kernels_init (void)
+{
+    const kernels_t *list[8];
+    int n = kernels_get_available (list, 8);
+    // widest is last
+    const kernels_t *k = list[n-1];
+
+    const char *force = getenv ("SPECTROGRAM_KERNELS");
+    if (force) {
+        for (int i = 0; i < n; i++) {
+            if (!strcmp (list[i]->name, force)) {
+                k = list[i];
+            }
+        }
+    }
+    kernels = *k;
+}
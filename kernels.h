@@ -0,0 +1,79 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __KERNELS_H
+#define __KERNELS_H
+
+#include <stdint.h>
+
+#include "fft.h"
+
+// how kernels_t.downmix turns interleaved frames into one signal
+enum {
+    // average of all channels
+    DOWNMIX_MEAN = 0,
+    // (L+R)/2 of the first two channels
+    DOWNMIX_MID = 1,
+    // (L-R)/2 of the first two channels, silence for mono
+    DOWNMIX_SIDE = 2,
+    // the sample with the largest magnitude, sign included
+    DOWNMIX_MAX_ABS = 3,
+    // a single channel, clamped to the last one
+    DOWNMIX_CHANNEL = 4,
+};
+
+/* Per-column inner loops.
+ *
+ * Every kernel exists as a scalar reference and as SSE2, AVX2 and AVX-512
+ * versions; kernels_init picks the widest one the CPU supports, so the same
+ * binary runs everywhere. The SIMD dB conversion uses its own log2, it
+ * differs from 10*log10f by less than 1e-4 dB. */
+typedef struct {
+    const char *name;
+    // buf[i] *= window[i]
+    void (*window) (sample_t *buf, const sample_t *window, int n);
+    // dst[i] = |src[i]|^2
+    void (*power) (sample_t *dst, const FFTW(complex) *src, int n);
+    // dst[i] = 10*log10 (src[i])
+    void (*db) (float *dst, const float *src, int n);
+    // dB value -> gradient table index, the gradient starts at db_offset
+    // below 0 dB and spans db_range
+    void (*color_index) (int32_t *dst, const float *db, int n, float db_offset, float db_range, int table_size);
+    // n frames of interleaved audio -> n samples, see DOWNMIX_*. Runs in the
+    // audio callback. Vectorized for stereo, other layouts are scalar.
+    void (*downmix) (sample_t *dst, const float *src, int n, int channels, int mode, int channel);
+    // dst[k] = sum of weight[offset[k] + i] * src[start[k] + i] for
+    // i < offset[k+1] - offset[k], the bands of a filterbank
+    void (*filterbank) (float *dst, const sample_t *src, const int *start, const int *offset, const float *weight, int rows);
+} kernels_t;
+
+// the implementation picked by kernels_init
+extern kernels_t kernels;
+
+// select the best implementation, the SPECTROGRAM_KERNELS environment
+// variable can force one by name (scalar, sse2, avx2, avx512)
+void
+kernels_init (void);
+
+// all implementations usable on this CPU, scalar reference first
+int
+kernels_get_available (const kernels_t **list, int max);
+
+#endif
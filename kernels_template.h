@@ -0,0 +1,285 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* SIMD kernels, included by kernels.c once per instruction set with
+ *   KERNEL_SUFFIX  name suffix (sse2, avx2, ...)
+ *   KERNEL_TARGET  gcc target attribute
+ *   KERNEL_WIDTH   floats per vector
+ *   KERNEL_EVEN, KERNEL_ODD  shuffle masks for deinterleaving complex values
+ * defined, and optionally
+ *   KERNEL_FILTERBANK  a narrower version of filterbank to use instead.
+ * The code is written with gcc vector extensions, the target attribute
+ * makes gcc emit the matching instructions. */
+
+#define KCAT2(a, b) a ## b
+#define KCAT(a, b) KCAT2(a, b)
+#define K(name) KCAT(name, KERNEL_SUFFIX)
+#define KSTR2(a) #a
+#define KSTR(a) KSTR2(a)
+#define KERNEL __attribute__ ((target (KERNEL_TARGET)))
+
+// unaligned, may alias the float arrays they are loaded from
+typedef float K(vf_) __attribute__ ((vector_size (KERNEL_WIDTH * 4), aligned (4), __may_alias__));
+typedef int32_t K(vi_) __attribute__ ((vector_size (KERNEL_WIDTH * 4), aligned (4), __may_alias__));
+#define vf K(vf_)
+#define vi K(vi_)
+
+static inline vf KERNEL
+K(vmin_) (vf a, vf b)
+{
+    vi m = a < b;
+    return (vf)(((vi)a & m) | ((vi)b & ~m));
+}
+
+static inline vf KERNEL
+K(vmax_) (vf a, vf b)
+{
+    vi m = a > b;
+    return (vf)(((vi)a & m) | ((vi)b & ~m));
+}
+
+// round to nearest even like lrintf, valid for |x| < 2^22
+static inline vi KERNEL
+K(vrint_) (vf x)
+{
+    x = (x + 12582912.f) - 12582912.f;
+    return __builtin_convertvector (x, vi);
+}
+
+// 10*log10 (x) for x >= 0, 0 gives -382 dB instead of -inf
+static inline vf KERNEL
+K(vdb_) (vf x)
+{
+    vi bits = (vi)x;
+    vi e = ((bits >> 23) & 0xff) - 127;
+    // mantissa in [1,2)
+    vf m = (vf)((bits & 0x007fffff) | 0x3f800000);
+    // ln (m) = 2 atanh (t) with t = (m-1)/(m+1) in [0,1/3)
+    vf t = (m - 1.f) / (m + 1.f);
+    vf t2 = t * t;
+    vf ln = t * (2.f + t2 * (2.f/3 + t2 * (2.f/5 + t2 * (2.f/7 + t2 * (2.f/9)))));
+    vf log2 = __builtin_convertvector (e, vf) + ln * 1.44269504088896f;
+    // 10*log10 (2)
+    return log2 * 3.01029995663981f;
+}
+
+static inline vi KERNEL
+K(vcolor_index_) (vf x, float db_offset, float db_range, int table_size)
+{
+    vf zero = {0};
+    x = x + db_offset;
+    x = K(vmax_) (x, zero);
+    x = K(vmin_) (x, zero + db_range);
+    vi idx = table_size - K(vrint_) (x * (table_size/db_range));
+    vi m = idx < 0;
+    idx = idx & ~m;
+    m = idx > table_size - 1;
+    return (idx & ~m) | ((table_size - 1) & m);
+}
+
+#ifndef USE_FFTW_DOUBLE
+static void KERNEL
+K(window_) (sample_t *buf, const sample_t *window, int n)
+{
+    int i = 0;
+    for (; i + KERNEL_WIDTH <= n; i += KERNEL_WIDTH) {
+        *(vf *)(buf + i) = *(const vf *)(buf + i) * *(const vf *)(window + i);
+    }
+    for (; i < n; i++) {
+        buf[i] *= window[i];
+    }
+}
+
+static void KERNEL
+K(power_) (sample_t *dst, const FFTW(complex) *src, int n)
+{
+    const vi even = KERNEL_EVEN;
+    const vi odd = KERNEL_ODD;
+    int i = 0;
+    for (; i + KERNEL_WIDTH <= n; i += KERNEL_WIDTH) {
+        vf a = *(const vf *)&src[i][0];
+        vf b = *(const vf *)&src[i + KERNEL_WIDTH/2][0];
+        vf re = __builtin_shuffle (a, b, even);
+        vf im = __builtin_shuffle (a, b, odd);
+        *(vf *)(dst + i) = re * re + im * im;
+    }
+    for (; i < n; i++) {
+        dst[i] = src[i][0] * src[i][0] + src[i][1] * src[i][1];
+    }
+}
+
+#define STEREO_LOOP(expr) \
+    for (; i + KERNEL_WIDTH <= n; i += KERNEL_WIDTH) { \
+        vf a = *(const vf *)(src + 2*i); \
+        vf b = *(const vf *)(src + 2*i + KERNEL_WIDTH); \
+        vf l = __builtin_shuffle (a, b, even); \
+        vf r = __builtin_shuffle (a, b, odd); \
+        (void)l; (void)r; \
+        *(vf *)(dst + i) = (expr); \
+    }
+
+// stereo only, everything else is left to the scalar version
+static void KERNEL
+K(downmix_) (sample_t *dst, const float *src, int n, int channels, int mode, int channel)
+{
+    if (channels != 2) {
+        downmix_scalar (dst, src, n, channels, mode, channel);
+        return;
+    }
+    const vi even = KERNEL_EVEN;
+    const vi odd = KERNEL_ODD;
+    int i = 0;
+    switch (mode) {
+    case DOWNMIX_SIDE:
+        STEREO_LOOP ((l - r) * 0.5f);
+        break;
+    case DOWNMIX_MAX_ABS:
+        STEREO_LOOP (({
+            vi m = ((vi)r & 0x7fffffff) > ((vi)l & 0x7fffffff);
+            (vf)(((vi)r & m) | ((vi)l & ~m));
+        }));
+        break;
+    case DOWNMIX_CHANNEL:
+        if (channel == 0) {
+            STEREO_LOOP (l);
+        }
+        else {
+            STEREO_LOOP (r);
+        }
+        break;
+    default:
+        // mean and mid are the same for stereo
+        STEREO_LOOP ((l + r) * 0.5f);
+        break;
+    }
+    // same arithmetic as the vector loop
+    downmix_scalar (dst + i, src + 2*i, n - i, channels, mode, channel);
+}
+#undef STEREO_LOOP
+
+#ifndef KERNEL_FILTERBANK
+// two accumulators, the adds of one vector don't wait for the other
+static inline float KERNEL
+K(dot_) (const float *weight, const sample_t *src, int n)
+{
+    vf acc0 = {0};
+    vf acc1 = {0};
+    int i = 0;
+    for (; i + 2*KERNEL_WIDTH <= n; i += 2*KERNEL_WIDTH) {
+        acc0 += *(const vf *)(weight + i) * *(const vf *)(src + i);
+        acc1 += *(const vf *)(weight + i + KERNEL_WIDTH) * *(const vf *)(src + i + KERNEL_WIDTH);
+    }
+    if (i + KERNEL_WIDTH <= n) {
+        acc0 += *(const vf *)(weight + i) * *(const vf *)(src + i);
+        i += KERNEL_WIDTH;
+    }
+    acc0 += acc1;
+    float sum = 0;
+    for (int j = 0; j < KERNEL_WIDTH; j++) {
+        sum += acc0[j];
+    }
+    // rows are short, a half vector keeps the scalar tail short as well
+    if (i + KERNEL_WIDTH/2 <= n) {
+        typedef float vh __attribute__ ((vector_size (KERNEL_WIDTH * 2), aligned (4), __may_alias__));
+        vh x = *(const vh *)(weight + i) * *(const vh *)(src + i);
+        for (int j = 0; j < KERNEL_WIDTH/2; j++) {
+            sum += x[j];
+        }
+        i += KERNEL_WIDTH/2;
+    }
+    for (; i < n; i++) {
+        sum += weight[i] * src[i];
+    }
+    return sum;
+}
+
+static void KERNEL
+K(filterbank_) (float *dst, const sample_t *src, const int *start, const int *offset, const float *weight, int rows)
+{
+    for (int k = 0; k < rows; k++) {
+        dst[k] = K(dot_) (weight + offset[k], src + start[k], offset[k+1] - offset[k]);
+    }
+}
+#endif
+#endif
+
+// the tails go through a zero padded vector, so that every element gets
+// exactly the same treatment as in the vector loop
+static void KERNEL
+K(db_) (float *dst, const float *src, int n)
+{
+    int i = 0;
+    for (; i + KERNEL_WIDTH <= n; i += KERNEL_WIDTH) {
+        *(vf *)(dst + i) = K(vdb_) (*(const vf *)(src + i));
+    }
+    if (i < n) {
+        float tmp[KERNEL_WIDTH] = {0};
+        memcpy (tmp, src + i, (n - i) * sizeof (float));
+        *(vf *)tmp = K(vdb_) (*(const vf *)tmp);
+        memcpy (dst + i, tmp, (n - i) * sizeof (float));
+    }
+}
+
+static void KERNEL
+K(color_index_) (int32_t *dst, const float *db, int n, float db_offset, float db_range, int table_size)
+{
+    int i = 0;
+    for (; i + KERNEL_WIDTH <= n; i += KERNEL_WIDTH) {
+        *(vi *)(dst + i) = K(vcolor_index_) (*(const vf *)(db + i), db_offset, db_range, table_size);
+    }
+    if (i < n) {
+        float tmp[KERNEL_WIDTH] = {0};
+        int32_t idx[KERNEL_WIDTH];
+        memcpy (tmp, db + i, (n - i) * sizeof (float));
+        *(vi *)idx = K(vcolor_index_) (*(const vf *)tmp, db_offset, db_range, table_size);
+        memcpy (dst + i, idx, (n - i) * sizeof (int32_t));
+    }
+}
+
+static const kernels_t K(kernels_) = {
+    .name = KSTR (KERNEL_SUFFIX),
+#ifndef USE_FFTW_DOUBLE
+    .window = K(window_),
+    .power = K(power_),
+    .downmix = K(downmix_),
+#ifdef KERNEL_FILTERBANK
+    .filterbank = KERNEL_FILTERBANK,
+#else
+    .filterbank = K(filterbank_),
+#endif
+#else
+    // no double precision versions, these are memory bound anyway
+    .window = window_scalar,
+    .power = power_scalar,
+    .downmix = downmix_scalar,
+    .filterbank = filterbank_scalar,
+#endif
+    .db = K(db_),
+    .color_index = K(color_index_),
+};
+
+#undef vf
+#undef vi
+#undef KERNEL
+#undef K
+#undef KCAT
+#undef KCAT2
+#undef KSTR
+#undef KSTR2
@@ -0,0 +1,351 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "kernels.h"
+#include "overview.h"
+#include "offline.h"
+
+// frames decoded per read
+#define OFFLINE_CHUNK 4096
+// segments per thread, so that partial results show up all over the track
+#define OFFLINE_SEGMENTS_PER_THREAD 4
+// columns per segment at most, a worker keeps a segment's spectra around
+#define OFFLINE_SEGMENT_COLUMNS 256
+
+struct offline_job_s {
+    DB_functions_t *deadbeef;
+    DB_playItem_t *track;
+    DB_decoder_t *decoder;
+    int fft_size;
+    int hop;
+    float duration;
+    // set by the first worker: columns (release) last, once the rest is
+    // set up; 0 until then and if that fails
+    int samplerate;
+    int64_t total_samples;
+    int columns;
+    // columns * fft_size/2 quantised powers, see history.h
+    uint8_t *data;
+    // per column, set (release) once it is in data
+    int *done;
+    int segments;
+    int next_segment;
+    int cancel;
+    int running;
+    int threads;
+    intptr_t tid[OFFLINE_MAX_THREADS];
+};
+
+// per worker state
+typedef struct {
+    DB_fileinfo_t *fi;
+    overview_t *overview;
+    char *raw;
+    float *pcm;
+    sample_t *mono;
+    // the spectra of the current segment
+    sample_t *spectra;
+} offline_worker_t;
+
+static void
+offline_worker_free (offline_job_t *job, offline_worker_t *wk)
+{
+    if (wk->fi) {
+        job->decoder->free (wk->fi);
+    }
+    if (wk->overview) {
+        overview_free (wk->overview);
+    }
+    free (wk->raw);
+    free (wk->pcm);
+    free (wk->mono);
+    free (wk->spectra);
+}
+
+static void
+offline_worker (void *ctx);
+
+// the first worker learns the format while opening its decoder, which is
+// too slow for the calling (GTK) thread, lays out the columns and starts
+// the others
+static int
+offline_probe (offline_job_t *job, const ddb_waveformat_t *fmt)
+{
+    job->samplerate = fmt->samplerate;
+    job->total_samples = (int64_t)(job->duration * fmt->samplerate);
+    int64_t columns = (job->total_samples + job->hop - 1) / job->hop;
+    if (columns < 1 || columns > INT_MAX / (job->fft_size/2)) {
+        return -1;
+    }
+    job->data = malloc ((size_t)columns * (job->fft_size/2));
+    job->done = calloc (columns, sizeof (int));
+    if (!job->data || !job->done) {
+        return -1;
+    }
+    job->segments = job->threads * OFFLINE_SEGMENTS_PER_THREAD;
+    if (job->segments < (columns + OFFLINE_SEGMENT_COLUMNS - 1) / OFFLINE_SEGMENT_COLUMNS) {
+        job->segments = (int)((columns + OFFLINE_SEGMENT_COLUMNS - 1) / OFFLINE_SEGMENT_COLUMNS);
+    }
+    if (job->segments > columns) {
+        job->segments = (int)columns;
+    }
+    __atomic_store_n (&job->columns, (int)columns, __ATOMIC_RELEASE);
+    // started after this, the others see the layout and so does anyone who
+    // sees one of their columns
+    for (int t = 1; t < job->threads; t++) {
+        job->tid[t] = job->deadbeef->thread_start_low_priority (offline_worker, job);
+        if (job->tid[t]) {
+            __atomic_fetch_add (&job->running, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+static int
+offline_worker_init (offline_job_t *job, offline_worker_t *wk, int first)
+{
+    memset (wk, 0, sizeof (offline_worker_t));
+    wk->fi = job->decoder->open (0);
+    if (!wk->fi) {
+        return -1;
+    }
+    if (job->decoder->init (wk->fi, job->track) != 0) {
+        job->decoder->free (wk->fi);
+        wk->fi = NULL;
+        return -1;
+    }
+    if (first && offline_probe (job, &wk->fi->fmt) < 0) {
+        return -1;
+    }
+    int channels = wk->fi->fmt.channels;
+    int max_columns = (job->columns + job->segments - 1) / job->segments;
+    wk->raw = malloc (OFFLINE_CHUNK * channels * (wk->fi->fmt.bps/8));
+    wk->pcm = malloc (OFFLINE_CHUNK * channels * sizeof (float));
+    wk->mono = malloc (OFFLINE_CHUNK * sizeof (sample_t));
+    wk->spectra = malloc (sizeof (sample_t) * (job->fft_size/2) * max_columns);
+    if (!wk->raw || !wk->pcm || !wk->mono || !wk->spectra) {
+        return -1;
+    }
+    // columns of exactly one hop, the last one is padded with silence
+    wk->overview = overview_new (job->fft_size, job->columns, (int64_t)job->columns * job->hop, FFTW_MEASURE);
+    return wk->overview ? 0 : -1;
+}
+
+// columns [c0,c1) of the segment starting at s0 are finished
+static void
+offline_publish (offline_job_t *job, offline_worker_t *wk, int s0, int c0, int c1)
+{
+    int bins = job->fft_size/2;
+    for (int c = c0; c < c1; c++) {
+        history_quantize (job->data + (size_t)c * bins, wk->spectra + (size_t)(c - s0) * bins, bins);
+        __atomic_store_n (&job->done[c], 1, __ATOMIC_RELEASE);
+    }
+}
+
+// seek_sample takes an int, which is only enough for the first 13 hours at
+// 44.1 kHz; decoders of API 1.15 and later have a 64 bit variant
+static int
+offline_seek (offline_job_t *job, DB_fileinfo_t *fi, int64_t pos)
+{
+#if (DDB_API_LEVEL >= 15)
+    DB_plugin_t *p = &job->decoder->plugin;
+    if ((p->api_vmajor > 1 || p->api_vminor >= 15) && job->decoder->seek_sample64) {
+        return job->decoder->seek_sample64 (fi, pos);
+    }
+#endif
+    if (pos > INT_MAX) {
+        return -1;
+    }
+    return job->decoder->seek_sample (fi, (int)pos);
+}
+
+static void
+offline_analyse_segment (offline_job_t *job, offline_worker_t *wk, int c0, int c1)
+{
+    ddb_waveformat_t *fmt = &wk->fi->fmt;
+    int frame_size = fmt->channels * (fmt->bps/8);
+    ddb_waveformat_t float_fmt = *fmt;
+    float_fmt.bps = 32;
+    float_fmt.is_float = 1;
+    float_fmt.is_bigendian = 0;
+
+    int64_t pos = overview_begin (wk->overview, c0, c1);
+    int c = c0;
+    // past the end of the data (or where we can't seek to) everything left
+    // is silence
+    if (offline_seek (job, wk->fi, pos) == 0) {
+        while (c < c1 && !__atomic_load_n (&job->cancel, __ATOMIC_RELAXED)) {
+            int bytes = job->decoder->read (wk->fi, wk->raw, OFFLINE_CHUNK * frame_size);
+            int frames = bytes > 0 ? bytes / frame_size : 0;
+            if (frames <= 0) {
+                break;
+            }
+            job->deadbeef->pcm_convert (fmt, wk->raw, &float_fmt, (char *)wk->pcm, frames * frame_size);
+            kernels.downmix (wk->mono, wk->pcm, frames, fmt->channels, DOWNMIX_MEAN, 0);
+            int next = overview_push (wk->overview, wk->mono, frames, wk->spectra);
+            offline_publish (job, wk, c0, c, next);
+            c = next;
+        }
+    }
+    if (c < c1 && !__atomic_load_n (&job->cancel, __ATOMIC_RELAXED)) {
+        offline_publish (job, wk, c0, c, overview_end (wk->overview, wk->spectra));
+    }
+}
+
+static void
+offline_worker_run (offline_job_t *job, int first)
+{
+    offline_worker_t wk;
+    if (offline_worker_init (job, &wk, first) == 0) {
+        while (!__atomic_load_n (&job->cancel, __ATOMIC_RELAXED)) {
+            int seg = __atomic_fetch_add (&job->next_segment, 1, __ATOMIC_RELAXED);
+            if (seg >= job->segments) {
+                break;
+            }
+            int c0 = (int)((int64_t)seg * job->columns / job->segments);
+            int c1 = (int)((int64_t)(seg + 1) * job->columns / job->segments);
+            offline_analyse_segment (job, &wk, c0, c1);
+        }
+    }
+    offline_worker_free (job, &wk);
+    __atomic_fetch_sub (&job->running, 1, __ATOMIC_RELEASE);
+}
+
+static void
+offline_worker (void *ctx)
+{
+    offline_worker_run (ctx, 0);
+}
+
+static void
+offline_first_worker (void *ctx)
+{
+    offline_worker_run (ctx, 1);
+}
+
+offline_job_t *
+offline_job_start (DB_functions_t *api, DB_playItem_t *it, int fft_size, int hop)
+{
+    char id[100] = "";
+    api->pl_lock ();
+    const char *dec_id = api->pl_find_meta (it, ":DECODER");
+    if (dec_id) {
+        strncpy (id, dec_id, sizeof (id) - 1);
+    }
+    api->pl_unlock ();
+    DB_decoder_t *decoder = (DB_decoder_t *)api->plug_get_for_id (id);
+    float duration = api->pl_get_item_duration (it);
+    if (!decoder || duration <= 0 || hop <= 0) {
+        return NULL;
+    }
+
+    offline_job_t *job = calloc (1, sizeof (offline_job_t));
+    if (!job) {
+        return NULL;
+    }
+    job->deadbeef = api;
+    job->track = it;
+    api->pl_item_ref (it);
+    job->decoder = decoder;
+    job->fft_size = fft_size;
+    job->hop = hop;
+    job->duration = duration;
+
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    job->threads = cpus < 1 ? 1 : (cpus > OFFLINE_MAX_THREADS ? OFFLINE_MAX_THREADS : (int)cpus);
+    // the first worker starts the others
+    job->running = 1;
+    job->tid[0] = api->thread_start_low_priority (offline_first_worker, job);
+    // the analysis of a whole track is too slow for the calling (GTK)
+    // thread, the widget stays in live mode instead
+    if (!job->tid[0]) {
+        offline_job_free (job);
+        return NULL;
+    }
+    return job;
+}
+
+void
+offline_job_free (offline_job_t *job)
+{
+    __atomic_store_n (&job->cancel, 1, __ATOMIC_RELAXED);
+    // the first worker starts the others, their ids are only complete once
+    // it's finished
+    for (int t = 0; t < job->threads; t++) {
+        if (job->tid[t]) {
+            job->deadbeef->thread_join (job->tid[t]);
+        }
+    }
+    job->deadbeef->pl_item_unref (job->track);
+    free (job->data);
+    free (job->done);
+    free (job);
+}
+
+int
+offline_job_fft_size (offline_job_t *job)
+{
+    return job->fft_size;
+}
+
+int
+offline_job_columns (offline_job_t *job)
+{
+    return __atomic_load_n (&job->columns, __ATOMIC_ACQUIRE);
+}
+
+float
+offline_job_samplerate (offline_job_t *job)
+{
+    return offline_job_columns (job) ? job->samplerate : 0;
+}
+
+const uint8_t *
+offline_job_column (offline_job_t *job, int c)
+{
+    if (c < 0 || c >= offline_job_columns (job) || !__atomic_load_n (&job->done[c], __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return job->data + (size_t)c * (job->fft_size/2);
+}
+
+const uint8_t *
+offline_job_data (offline_job_t *job)
+{
+    int columns = offline_job_columns (job);
+    for (int c = 0; c < columns; c++) {
+        if (!__atomic_load_n (&job->done[c], __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+    }
+    return columns ? job->data : NULL;
+}
+
+int
+offline_job_finished (offline_job_t *job)
+{
+    return __atomic_load_n (&job->running, __ATOMIC_ACQUIRE) == 0;
+}
@@ -0,0 +1,78 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __OFFLINE_H
+#define __OFFLINE_H
+
+#include <deadbeef/deadbeef.h>
+
+#include "fft.h"
+
+// more doesn't help, the decoders are the bottleneck by then
+#define OFFLINE_MAX_THREADS 8
+
+/* Whole-track analysis in the background.
+ *
+ * The track is decoded a second time, independently of playback, and cut
+ * into columns of hop samples each, see overview.h. The column grid only
+ * depends on the track, the FFT size and the hop, not on how wide the
+ * image is; it's scaled to the widget when it's drawn. The columns are split
+ * into segments that worker threads pick up one after another, every worker
+ * has its own decoder instance and FFT plan. Finished columns are kept
+ * quantised like the history (see history.h) and can be drawn right away.
+ * Nothing is opened in the calling thread, the first worker learns the
+ * track's format, lays out the columns and starts the others. */
+typedef struct offline_job_s offline_job_t;
+
+// returns NULL if the track has no decoder, no known length or no worker
+// thread can be started. A track that turns out not to open finishes
+// without columns.
+offline_job_t *
+offline_job_start (DB_functions_t *api, DB_playItem_t *it, int fft_size, int hop);
+
+// cancels the workers, waits for them and frees the job
+void
+offline_job_free (offline_job_t *job);
+
+int
+offline_job_fft_size (offline_job_t *job);
+
+// both 0 until the first worker has opened the track
+int
+offline_job_columns (offline_job_t *job);
+
+float
+offline_job_samplerate (offline_job_t *job);
+
+// quantised power spectrum (fft_size/2 bins) of column c, NULL if it
+// isn't done yet
+const uint8_t *
+offline_job_column (offline_job_t *job, int c);
+
+// all columns quantised (columns * fft_size/2 bytes) once every one of
+// them is done, NULL before
+const uint8_t *
+offline_job_data (offline_job_t *job);
+
+// 1 once all workers are finished
+int
+offline_job_finished (offline_job_t *job);
+
+#endif
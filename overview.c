@@ -0,0 +1,178 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "ringbuf.h"
+#include "overview.h"
+
+// samples buffered on top of one window
+#define OVERVIEW_CHUNK 8192
+
+struct overview_s {
+    int fft_size;
+    int columns;
+    int64_t total_samples;
+    double span;
+    int windows;
+    sample_t *window;
+    FFTW(plan) plan;
+    sample_t *in;
+    FFTW(complex) *out;
+    sample_t *power;
+    // the current range: ring positions are relative to base, the first
+    // windows reach back up to fft_size samples before the range (silence
+    // at the signal start)
+    ringbuf_t hist;
+    int64_t base;
+    int c0;
+    int c;
+    int c1;
+    // next window of column c
+    int k;
+};
+
+overview_t *
+overview_new (int fft_size, int columns, int64_t total_samples, unsigned plan_flags)
+{
+    overview_t *o = calloc (1, sizeof (overview_t));
+    if (!o) {
+        return NULL;
+    }
+    int bins = fft_size/2;
+    o->fft_size = fft_size;
+    o->columns = columns;
+    o->total_samples = total_samples;
+    o->span = (double)total_samples / columns;
+    o->windows = (int)(o->span / fft_size);
+    o->windows = o->windows < 1 ? 1 : (o->windows > OVERVIEW_MAX_WINDOWS ? OVERVIEW_MAX_WINDOWS : o->windows);
+    o->window = simd_malloc (sizeof (sample_t) * fft_size);
+    o->in = simd_malloc (sizeof (sample_t) * fft_size);
+    o->out = simd_malloc (sizeof (FFTW(complex)) * (bins + 1));
+    o->power = simd_malloc (sizeof (sample_t) * bins);
+    if (!o->window || !o->in || !o->out || !o->power || ringbuf_init (&o->hist, fft_size + OVERVIEW_CHUNK) < 0) {
+        overview_free (o);
+        return NULL;
+    }
+    o->plan = fft_plan_r2c (fft_size, o->in, o->out, plan_flags);
+    if (!o->plan) {
+        overview_free (o);
+        return NULL;
+    }
+    fft_window_blackman_harris (o->window, fft_size);
+    return o;
+}
+
+void
+overview_free (overview_t *o)
+{
+    if (o->plan) {
+        fft_destroy_plan (o->plan);
+    }
+    ringbuf_free (&o->hist);
+    free (o->window);
+    free (o->in);
+    free (o->out);
+    free (o->power);
+    free (o);
+}
+
+// window k of column c ends here (absolute sample position)
+static int64_t
+overview_window_end (overview_t *o, int c, int k)
+{
+    return (int64_t)(c * o->span + (k + 1) * o->span / o->windows);
+}
+
+int64_t
+overview_begin (overview_t *o, int c0, int c1)
+{
+    o->c0 = c0;
+    o->c = c0;
+    o->c1 = c1;
+    o->k = 0;
+    o->base = (int64_t)(c0 * o->span) - o->fft_size;
+    int64_t pos = o->base > 0 ? o->base : 0;
+    // start over, the ring was allocated by overview_new
+    ringbuf_reset (&o->hist);
+    ringbuf_skip_to (&o->hist, pos - o->base);
+    return pos;
+}
+
+// analyse every window that has all its samples, or all remaining ones
+// (with silence for what's missing) at the end
+static void
+overview_drain (overview_t *o, sample_t *spectra, int eof)
+{
+    int fft_size = o->fft_size;
+    int bins = fft_size/2;
+    int64_t have = ringbuf_write_pos (&o->hist);
+    while (o->c < o->c1) {
+        int64_t end = overview_window_end (o, o->c, o->k) - o->base;
+        if (end > have && !eof) {
+            break;
+        }
+        sample_t *column = spectra + (size_t)(o->c - o->c0) * bins;
+        if (end <= have && ringbuf_read (&o->hist, o->in, end, fft_size) == 0) {
+            kernels.window (o->in, o->window, fft_size);
+            FFTW(execute) (o->plan);
+            // peak of all windows in the column
+            kernels.power (o->k == 0 ? column : o->power, o->out, bins);
+            if (o->k > 0) {
+                for (int i = 0; i < bins; i++) {
+                    if (o->power[i] > column[i]) {
+                        column[i] = o->power[i];
+                    }
+                }
+            }
+        }
+        else if (o->k == 0) {
+            memset (column, 0, sizeof (sample_t) * bins);
+        }
+        if (++o->k == o->windows) {
+            o->c++;
+            o->k = 0;
+        }
+    }
+}
+
+int
+overview_push (overview_t *o, const sample_t *in, int n, sample_t *spectra)
+{
+    // never more than fits on top of the window that's still needed
+    int chunk = o->hist.size - o->fft_size;
+    while (n > 0 && o->c < o->c1) {
+        int m = n < chunk ? n : chunk;
+        ringbuf_write (&o->hist, in, m);
+        overview_drain (o, spectra, 0);
+        in += m;
+        n -= m;
+    }
+    return o->c;
+}
+
+int
+overview_end (overview_t *o, sample_t *spectra)
+{
+    overview_drain (o, spectra, 1);
+    return o->c;
+}
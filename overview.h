@@ -0,0 +1,63 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __OVERVIEW_H
+#define __OVERVIEW_H
+
+#include <stdint.h>
+
+#include "fft.h"
+
+// FFT windows per column at most, longer columns are sampled
+#define OVERVIEW_MAX_WINDOWS 8
+
+/* Spectrogram of a whole signal at a fixed number of columns.
+ *
+ * The signal of total_samples (mono) is cut into as many columns as the
+ * image is wide. Each column is the peak of up to OVERVIEW_MAX_WINDOWS FFT
+ * windows in its time span. Columns can be analysed in independent ranges,
+ * e.g. by several threads with an overview each: overview_begin tells where
+ * the input of a range starts, the samples are then pushed in order.
+ * Finished columns go to spectra, which holds the current range: column c
+ * at (c-c0)*fft_size/2. */
+typedef struct overview_s overview_t;
+
+overview_t *
+overview_new (int fft_size, int columns, int64_t total_samples, unsigned plan_flags);
+
+void
+overview_free (overview_t *o);
+
+// analyse columns [c0,c1) next, returns the sample position the input
+// has to start at
+int64_t
+overview_begin (overview_t *o, int c0, int c1);
+
+// feed the next n samples, returns the first column that isn't finished
+// yet; all before it are in spectra
+int
+overview_push (overview_t *o, const sample_t *in, int n, sample_t *spectra);
+
+// end of input, the remaining columns get what's there and silence after
+// that. Returns c1.
+int
+overview_end (overview_t *o, sample_t *spectra);
+
+#endif
@@ -0,0 +1,154 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <string.h>
+
+#include "profile.h"
+
+// 4 buckets per octave from 1 ns up to 2^48 ns
+#define PROFILE_SUB_BITS 2
+#define PROFILE_BUCKETS (48 << PROFILE_SUB_BITS)
+#define PROFILE_PERIOD 1000000000
+
+typedef struct {
+    uint64_t start;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[PROFILE_BUCKETS];
+} profile_window_t;
+
+typedef struct {
+    profile_window_t current;
+    // the last complete window, guarded by a sequence counter that is odd
+    // while it's being replaced
+    profile_window_t last;
+    unsigned seq;
+} profile_stage_t;
+
+static profile_stage_t stages[PROFILE_STAGES];
+
+static const char *stage_names[PROFILE_STAGES] = {
+    "listener",
+    "fft",
+    "lock",
+    "render",
+    "paint",
+};
+
+static int
+profile_bucket (uint64_t ns)
+{
+    if (ns < (1 << PROFILE_SUB_BITS)) {
+        return ns;
+    }
+    int octave = 63 - __builtin_clzll (ns);
+    int sub = (ns >> (octave - PROFILE_SUB_BITS)) & ((1 << PROFILE_SUB_BITS) - 1);
+    int bucket = ((octave - PROFILE_SUB_BITS + 1) << PROFILE_SUB_BITS) + sub;
+    return bucket < PROFILE_BUCKETS ? bucket : PROFILE_BUCKETS - 1;
+}
+
+// smallest value of the next bucket
+static double
+profile_bucket_end (int bucket)
+{
+    if (bucket < (1 << PROFILE_SUB_BITS)) {
+        return bucket + 1;
+    }
+    int octave = (bucket >> PROFILE_SUB_BITS) + PROFILE_SUB_BITS - 1;
+    int sub = bucket & ((1 << PROFILE_SUB_BITS) - 1);
+    return (double)(((1 << PROFILE_SUB_BITS) + sub + 1)) * ((uint64_t)1 << (octave - PROFILE_SUB_BITS));
+}
+
+void
+profile_record (int stage, uint64_t ns)
+{
+    profile_stage_t *s = &stages[stage];
+    profile_window_t *w = &s->current;
+    uint64_t now = profile_now ();
+    if (now - w->start >= PROFILE_PERIOD) {
+        if (w->count > 0) {
+            __atomic_add_fetch (&s->seq, 1, __ATOMIC_ACQ_REL);
+            memcpy (&s->last, w, sizeof (profile_window_t));
+            __atomic_add_fetch (&s->seq, 1, __ATOMIC_RELEASE);
+        }
+        memset (w, 0, sizeof (profile_window_t));
+        w->start = now;
+        w->min = UINT64_MAX;
+    }
+    w->count++;
+    w->sum += ns;
+    w->min = ns < w->min ? ns : w->min;
+    w->max = ns > w->max ? ns : w->max;
+    w->buckets[profile_bucket (ns)]++;
+}
+
+const char *
+profile_stage_name (int stage)
+{
+    return stage_names[stage];
+}
+
+void
+profile_get (int stage, profile_stats_t *stats)
+{
+    profile_stage_t *s = &stages[stage];
+    profile_window_t w;
+    unsigned seq;
+    do {
+        seq = __atomic_load_n (&s->seq, __ATOMIC_ACQUIRE);
+        memcpy (&w, &s->last, sizeof (profile_window_t));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n (&s->seq, __ATOMIC_RELAXED));
+
+    memset (stats, 0, sizeof (profile_stats_t));
+    if (w.count == 0) {
+        return;
+    }
+    stats->count = w.count;
+    stats->min = w.min;
+    stats->max = w.max;
+    stats->avg = (double)w.sum / w.count;
+    uint64_t rank = w.count - w.count / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += w.buckets[b];
+        if (seen >= rank) {
+            stats->p99 = profile_bucket_end (b);
+            break;
+        }
+    }
+    // the bucket edge can be past the largest sample
+    if (stats->p99 > stats->max) {
+        stats->p99 = stats->max;
+    }
+}
+
+void
+profile_dump (FILE *f)
+{
+    for (int i = 0; i < PROFILE_STAGES; i++) {
+        profile_stats_t st;
+        profile_get (i, &st);
+        fprintf (f, "%-8s n %6llu  min %9.0f  avg %9.0f  p99 %9.0f  max %9.0f ns\n", stage_names[i],
+                (unsigned long long)st.count, st.min, st.avg, st.p99, st.max);
+    }
+}
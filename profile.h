@@ -0,0 +1,88 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Per-stage timing, only built with ENABLE_PROFILING (make PROFILING=1).
+ *
+ * PROFILE_BEGIN and PROFILE_END bracket a stage in the same scope and
+ * expand to nothing otherwise. Every sample goes into a histogram with four
+ * buckets per octave; the histograms are rolled over every second and the
+ * last complete one is what profile_get reports. Each stage must only be
+ * recorded from one thread at a time, any thread can read. */
+enum {
+    // audio callback, downmix into the STFT
+    PROFILE_LISTENER = 0,
+    // one column: window, FFT and power spectrum
+    PROFILE_FFT,
+    // GTK thread waiting for the engine mutex
+    PROFILE_LOCK,
+    // one column: spectrum -> pixels
+    PROFILE_RENDER,
+    // one frame: cairo painting the surface
+    PROFILE_PAINT,
+    PROFILE_STAGES,
+};
+
+typedef struct {
+    uint64_t count;
+    // nanoseconds, p99 is the upper edge of its histogram bucket
+    double min;
+    double avg;
+    double p99;
+    double max;
+} profile_stats_t;
+
+#ifdef ENABLE_PROFILING
+#define PROFILE_BEGIN(stage) uint64_t profile_t0_ ## stage = profile_now ()
+#define PROFILE_END(stage) profile_record (stage, profile_now () - profile_t0_ ## stage)
+#else
+#define PROFILE_BEGIN(stage)
+#define PROFILE_END(stage)
+#endif
+
+static inline uint64_t
+profile_now (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+profile_record (int stage, uint64_t ns);
+
+const char *
+profile_stage_name (int stage);
+
+// statistics of the last complete second
+void
+profile_get (int stage, profile_stats_t *stats);
+
+// one line per stage
+void
+profile_dump (FILE *f);
+
+#endif
@@ -0,0 +1,445 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fastftoi.h"
+#include "filterbank.h"
+#include "kernels.h"
+#include "raster.h"
+
+// power -> colour table, indexed by the float exponent and the top mantissa
+// bits of the power
+#define COLOR_LUT_MANTISSA_BITS 7
+#define COLOR_LUT_SIZE (1 << (8 + COLOR_LUT_MANTISSA_BITS))
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef CLAMP
+#define CLAMP(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+#endif
+
+typedef struct {
+    // the row shows the loudest bin in [lo,hi)
+    int32_t lo;
+    int32_t hi;
+    // interpolated rows only: weight of the next distinct bin
+    int32_t next;
+    float weight;
+} row_map_t;
+
+struct raster_s {
+    uint32_t colors[RASTER_GRADIENT_TABLE_SIZE];
+    int db_range;
+    // colours of the power values, see raster_update_color_lut. Rebuilt
+    // when the dB range or the gradient changes.
+    uint32_t *color_lut;
+    int color_lut_valid;
+    // how each pixel row is computed from the bins, see
+    // raster_set_geometry
+    row_map_t *map;
+    int height;
+    int fft_size;
+    float samplerate;
+    int scale;
+    // shown frequency range, see raster_set_range
+    float min_freq;
+    float max_freq;
+    // constant-Q bins instead of the FFT geometry, 0 if not
+    int cqt_bins;
+    // mel and Bark scales: one band per row instead of the map
+    filterbank_t *filterbank;
+    // the lowest rows are interpolated
+    int interp_rows;
+    // per row scratch space for raster_render_column
+    float *rows;
+    float *interp;
+    int32_t *row_index;
+};
+
+raster_t *
+raster_new (void)
+{
+    raster_t *r = calloc (1, sizeof (raster_t));
+    if (!r) {
+        return NULL;
+    }
+    r->db_range = 70;
+    r->map = malloc (sizeof (row_map_t) * RASTER_MAX_HEIGHT);
+    r->color_lut = malloc (sizeof (uint32_t) * COLOR_LUT_SIZE);
+    r->rows = simd_malloc (sizeof (float) * RASTER_MAX_HEIGHT);
+    r->interp = simd_malloc (sizeof (float) * RASTER_MAX_HEIGHT);
+    r->row_index = simd_malloc (sizeof (int32_t) * RASTER_MAX_HEIGHT);
+    if (!r->map || !r->color_lut || !r->rows || !r->interp || !r->row_index) {
+        raster_free (r);
+        return NULL;
+    }
+    return r;
+}
+
+static void
+raster_free_filterbank (raster_t *r)
+{
+    if (r->filterbank) {
+        filterbank_free (r->filterbank);
+        r->filterbank = NULL;
+    }
+}
+
+void
+raster_free (raster_t *r)
+{
+    raster_free_filterbank (r);
+    free (r->map);
+    free (r->color_lut);
+    free (r->rows);
+    free (r->interp);
+    free (r->row_index);
+    free (r);
+}
+
+/* based on Delphi function by Witold J.Janik */
+void
+raster_set_gradient (raster_t *r, const uint32_t *colors, int num_colors)
+{
+    num_colors -= 1;
+
+    for (int i = 0; i < RASTER_GRADIENT_TABLE_SIZE; i++) {
+        double position = (double)i/RASTER_GRADIENT_TABLE_SIZE;
+        /* if position > 1 then we have repetition of colors it maybe useful    */
+        if (position > 1.0) {
+            if (position - ftoi (position) == 0.0) {
+                position = 1.0;
+            }
+            else {
+                position = position - ftoi (position);
+            }
+        }
+
+        double m= num_colors * position;
+        int n=(int)m; // integer of m
+        double f=m-n;  // fraction of m
+
+        uint32_t color = 0xFFFFFF;
+        if (num_colors == 0) {
+            color = colors[0];
+        }
+        else if (n < num_colors) {
+            color = 0;
+            for (int shift = 0; shift < 24; shift += 8) {
+                float c0 = (colors[n] >> shift) & 0xFF;
+                float c1 = (colors[n+1] >> shift) & 0xFF;
+                color |= ((uint32_t)(c0 + f * (c1 - c0)) & 0xFF) << shift;
+            }
+        }
+        else if (n == num_colors) {
+            color = colors[n];
+        }
+        r->colors[i] = 0xFF000000 | (color & 0xFFFFFF);
+    }
+    r->color_lut_valid = 0;
+}
+
+void
+raster_set_db_range (raster_t *r, int db_range)
+{
+    if (db_range != r->db_range) {
+        r->db_range = db_range;
+        r->color_lut_valid = 0;
+    }
+}
+
+void
+raster_set_range (raster_t *r, float min_freq, float max_freq)
+{
+    if (min_freq != r->min_freq || max_freq != r->max_freq) {
+        r->min_freq = min_freq;
+        r->max_freq = max_freq;
+        // the geometry has to be rebuilt
+        r->height = 0;
+    }
+}
+
+// the shown range for a sample rate, the whole spectrum above bottom if
+// the configured one is empty
+static void
+raster_get_range (raster_t *r, float samplerate, float bottom, float *lo, float *hi)
+{
+    float nyquist = samplerate/2;
+    *lo = CLAMP (MAX (r->min_freq, bottom), 0, nyquist);
+    *hi = r->max_freq > 0 ? MIN (r->max_freq, nyquist) : nyquist;
+    if (*hi <= *lo) {
+        *lo = bottom;
+        *hi = nyquist;
+    }
+}
+
+int
+raster_set_geometry (raster_t *r, int height, int fft_size, float samplerate, int scale)
+{
+    height = CLAMP (height, 1, RASTER_MAX_HEIGHT);
+    if (height == r->height && fft_size == r->fft_size && !r->cqt_bins
+            && samplerate == r->samplerate && scale == r->scale) {
+        return 0;
+    }
+    r->cqt_bins = 0;
+    r->height = height;
+    r->fft_size = fft_size;
+    r->samplerate = samplerate;
+    r->scale = scale;
+    raster_free_filterbank (r);
+
+    if (scale == RASTER_SCALE_MEL || scale == RASTER_SCALE_BARK) {
+        int type = scale == RASTER_SCALE_MEL ? FILTERBANK_MEL : FILTERBANK_BARK;
+        float lo, hi;
+        raster_get_range (r, samplerate, RASTER_MIN_FREQ, &lo, &hi);
+        r->filterbank = filterbank_new (type, height, fft_size, samplerate, lo, hi);
+        if (r->filterbank) {
+            r->interp_rows = 0;
+            return 1;
+        }
+        // out of memory, the log scale is close enough
+        scale = RASTER_SCALE_LOG;
+    }
+    int log_scale = scale == RASTER_SCALE_LOG;
+
+    int bins = fft_size/2;
+    float lo, hi;
+    raster_get_range (r, samplerate, log_scale ? RASTER_MIN_FREQ : 0, &lo, &hi);
+
+    // centre bin of every row
+    int log_index[RASTER_MAX_HEIGHT];
+    int low_res_end = -1;
+    float freq_res = samplerate / fft_size;
+    float log_step = (log2f(hi)-log2f(lo))/(height);
+    for (int i = 0; i < height; i++) {
+        float freq = log_scale ? powf(2.,((float)i) * log_step + log2f(lo)) : lo + (hi - lo) * i / height;
+        log_index[i] = ftoi (freq / freq_res);
+        if (i > 0 && log_index[i-1] == log_index [i]) {
+            low_res_end = i;
+        }
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        int index0, index1;
+        int bin0, bin1, bin2;
+        bin0 = log_index[CLAMP (i-1,0,height-1)];
+        bin1 = log_index[i];
+        bin2 = log_index[CLAMP (i+1,0,height-1)];
+
+        index0 = bin0 + ftoi ((bin1 - bin0)/2.f);
+        if (index0 == bin0) index0 = bin1;
+        index1 = bin1 + ftoi ((bin2 - bin1)/2.f);
+        if (index1 == bin2) index1 = bin1;
+
+        index0 = CLAMP (index0,0,bins-1);
+        index1 = CLAMP (index1,0,bins-1);
+
+        // the row shows the loudest bin of [index0,index1), or only index1
+        // if that range is empty
+        row_map_t *m = &r->map[i];
+        if (index0 >= index1) {
+            m->lo = index1;
+            m->hi = index1 + 1;
+        }
+        else {
+            m->lo = index0;
+            m->hi = index1;
+        }
+        m->next = 0;
+        m->weight = 0;
+    }
+
+    // several rows at the bottom of the log scale (or all of them if the
+    // range is narrow) show the same bin, interpolate between it and the
+    // next distinct one
+    r->interp_rows = low_res_end + 1;
+    for (int i = 0; i < r->interp_rows; i++) {
+        int j = 0;
+        // find index of next value
+        while (i+j < height && log_index[i+j] == log_index[i]) {
+            j++;
+        }
+        r->map[i].next = CLAMP (log_index[MIN (i+j, height-1)], 0, bins-1);
+
+        int k = 0;
+        while ((k+i) >= 0 && log_index[k+i] == log_index[i]) {
+            j++;
+            k--;
+        }
+        r->map[i].weight = (1.0/(j-1)) * ((-1 * k) - 1);
+    }
+    return 1;
+}
+
+int
+raster_set_cqt_geometry (raster_t *r, int height, int bins)
+{
+    height = CLAMP (height, 1, RASTER_MAX_HEIGHT);
+    bins = MAX (bins, 1);
+    if (height == r->height && bins == r->cqt_bins) {
+        return 0;
+    }
+    r->height = height;
+    r->cqt_bins = bins;
+    r->fft_size = 0;
+    raster_free_filterbank (r);
+
+    if (height <= bins) {
+        // every row shows the loudest of its bins
+        for (int i = 0; i < height; i++) {
+            row_map_t *m = &r->map[i];
+            m->lo = (int)((int64_t)i * bins / height);
+            m->hi = MAX ((int)((int64_t)(i+1) * bins / height), m->lo + 1);
+            m->next = 0;
+            m->weight = 0;
+        }
+        r->interp_rows = 0;
+        return 1;
+    }
+
+    // more rows than bins, interpolate between the bins around the centre
+    // of every row
+    for (int i = 0; i < height; i++) {
+        float pos = ((float)i + 0.5f) * bins / height - 0.5f;
+        pos = CLAMP (pos, 0, bins - 1);
+        row_map_t *m = &r->map[i];
+        m->lo = (int)pos;
+        m->hi = m->lo + 1;
+        m->next = MIN (m->lo + 1, bins - 1);
+        m->weight = pos - m->lo;
+    }
+    r->interp_rows = height;
+    return 1;
+}
+
+int
+raster_height (raster_t *r)
+{
+    return r->height;
+}
+
+uint32_t
+raster_background (raster_t *r)
+{
+    return r->colors[RASTER_GRADIENT_TABLE_SIZE-1];
+}
+
+/* Each entry covers all powers with the same exponent and top
+ * COLOR_LUT_MANTISSA_BITS mantissa bits, i.e. a ratio of at most 1+1/128 or
+ * 0.034 dB. The entry is computed at the middle of that span, so it's at most
+ * 0.017 dB off. That is less than a gradient step (70 dB/2048 = 0.034 dB for
+ * the default range), the looked up colour is never more than one step away
+ * from the exact one. */
+static void
+raster_update_color_lut (raster_t *r)
+{
+    if (r->color_lut_valid) {
+        return;
+    }
+    r->color_lut_valid = 1;
+
+    float db_offset = r->db_range - RASTER_DB_MAX;
+    const int shift = 23 - COLOR_LUT_MANTISSA_BITS;
+    const int per_exponent = 1 << COLOR_LUT_MANTISSA_BITS;
+    float db[1 << COLOR_LUT_MANTISSA_BITS];
+    int32_t index[1 << COLOR_LUT_MANTISSA_BITS];
+
+    for (int e = 0; e < 256; e++) {
+        for (int m = 0; m < per_exponent; m++) {
+            union { uint32_t u; float f; } v;
+            v.u = ((uint32_t)(e * per_exponent + m) << shift) | (1 << (shift - 1));
+            // zero and denormals are silence, inf and nan just clamp
+            db[m] = e == 0 ? -INFINITY : 10 * log10f (v.f);
+        }
+        kernels.color_index (index, db, per_exponent, db_offset, r->db_range, RASTER_GRADIENT_TABLE_SIZE);
+        for (int m = 0; m < per_exponent; m++) {
+            r->color_lut[e * per_exponent + m] = r->colors[index[m]];
+        }
+    }
+}
+
+static inline uint32_t
+raster_lookup_color (const raster_t *r, float power)
+{
+    union { float f; uint32_t u; } v = { .f = power };
+    return r->color_lut[(v.u >> (23 - COLOR_LUT_MANTISSA_BITS)) & (COLOR_LUT_SIZE - 1)];
+}
+
+static inline float
+linear_interpolate (float y1, float y2, float mu)
+{
+       return (y1 * (1 - mu) + y2 * mu);
+}
+
+void
+raster_render_column (raster_t *r, const sample_t *spectrum, uint32_t *dst, ptrdiff_t stride)
+{
+    raster_update_color_lut (r);
+    int height = r->height;
+
+    if (r->filterbank) {
+        // the band energies are the rows
+        filterbank_apply (r->filterbank, spectrum, r->rows);
+        for (int i = 0; i < height; i++) {
+            dst[i * stride] = raster_lookup_color (r, r->rows[i]);
+        }
+        return;
+    }
+
+    // gather the power of every row
+    for (int i = 0; i < height; i++) {
+        const row_map_t *m = &r->map[i];
+        float value = spectrum[m->lo];
+        for (int b = m->lo + 1; b < m->hi; b++) {
+            value = MAX (value, spectrum[b]);
+        }
+        r->rows[i] = value;
+    }
+
+    // everything above the interpolated rows is a table lookup
+    int interp_rows = r->interp_rows;
+    for (int i = interp_rows; i < height; i++) {
+        dst[i * stride] = raster_lookup_color (r, r->rows[i]);
+    }
+
+    if (interp_rows > 0) {
+        float db_offset = r->db_range - RASTER_DB_MAX;
+        for (int i = 0; i < interp_rows; i++) {
+            r->interp[i] = spectrum[r->map[i].next];
+        }
+        kernels.db (r->rows, r->rows, interp_rows);
+        kernels.db (r->interp, r->interp, interp_rows);
+        for (int i = 0; i < interp_rows; i++) {
+            r->rows[i] = linear_interpolate (r->rows[i], r->interp[i], r->map[i].weight);
+        }
+        kernels.color_index (r->row_index, r->rows, interp_rows, db_offset, r->db_range, RASTER_GRADIENT_TABLE_SIZE);
+        for (int i = 0; i < interp_rows; i++) {
+            dst[i * stride] = r->colors[r->row_index[i]];
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __RASTER_H
+#define __RASTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft.h"
+
+#define RASTER_GRADIENT_TABLE_SIZE 2048
+// taller columns are clipped, rows above are left alone
+#define RASTER_MAX_HEIGHT 4096
+// power in dB that gets the loudest colour, the gradient spans db_range
+// below it
+#define RASTER_DB_MAX 63
+// bottom of the logarithmic and perceptual scales in Hz
+#define RASTER_MIN_FREQ 25.f
+
+// frequency scales of raster_set_geometry
+enum {
+    RASTER_SCALE_LINEAR = 0,
+    RASTER_SCALE_LOG = 1,
+    // the rows are the bands of a filterbank, see filterbank.h
+    RASTER_SCALE_MEL = 2,
+    RASTER_SCALE_BARK = 3,
+};
+
+/* Power spectrum -> column of pixels, the drawing half of the spectrogram
+ * without any GUI dependencies.
+ *
+ * Pixels are 32 bit 0xAARRGGBB in native byte order (cairo's ARGB32 and
+ * RGB24), always opaque. The frequency scale (RASTER_SCALE_*), the
+ * dB range and the colour gradient are settings of the raster; everything
+ * derived from them is cached and rebuilt only when they change. */
+typedef struct raster_s raster_t;
+
+raster_t *
+raster_new (void);
+
+void
+raster_free (raster_t *r);
+
+// colours (0xRRGGBB) from loud to silent, at most 7
+void
+raster_set_gradient (raster_t *r, const uint32_t *colors, int num_colors);
+
+// dynamic range of the gradient in dB
+void
+raster_set_db_range (raster_t *r, int db_range);
+
+// frequencies in Hz shown at the bottom and the top of the column, 0 for
+// the bottom of the scale and the Nyquist frequency. Takes effect with the
+// next raster_set_geometry, which returns 1 if it changed.
+void
+raster_set_range (raster_t *r, float min_freq, float max_freq);
+
+// column height and how the FFT bins map to it on the given scale
+// (RASTER_SCALE_*), returns 1 if the mapping changed, i.e. the columns
+// drawn so far don't match anymore
+int
+raster_set_geometry (raster_t *r, int height, int fft_size, float samplerate, int scale);
+
+// column height for constant-Q spectra of bins values, see cqt.h. The
+// bins are spaced logarithmically already and are spread evenly over the
+// rows. Returns 1 if the mapping changed, like raster_set_geometry.
+int
+raster_set_cqt_geometry (raster_t *r, int height, int bins);
+
+// rows per column, the geometry height clipped to RASTER_MAX_HEIGHT
+int
+raster_height (raster_t *r);
+
+// colour of silence, for areas without data
+uint32_t
+raster_background (raster_t *r);
+
+// render fft_size/2 power values (or the constant-Q bins) into raster_height pixels. dst is the
+// lowest frequency, the next row up is stride pixels further (usually
+// negative for images stored top down).
+void
+raster_render_column (raster_t *r, const sample_t *spectrum, uint32_t *dst, ptrdiff_t stride);
+
+#endif
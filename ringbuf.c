@@ -0,0 +1,145 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuf.h"
+
+int
+ringbuf_init (ringbuf_t *rb, size_t size)
+{
+    size_t sz = 1;
+    while (sz < size) {
+        sz <<= 1;
+    }
+    rb->data = simd_malloc (sizeof (sample_t) * sz);
+    if (!rb->data) {
+        return -1;
+    }
+    memset (rb->data, 0, sizeof (sample_t) * sz);
+    rb->size = sz;
+    rb->mask = sz - 1;
+    rb->write_pos = 0;
+    rb->reserve_pos = 0;
+    return 0;
+}
+
+void
+ringbuf_free (ringbuf_t *rb)
+{
+    if (rb->data) {
+        free (rb->data);
+        rb->data = NULL;
+    }
+    rb->size = 0;
+    rb->mask = 0;
+}
+
+void
+ringbuf_reset (ringbuf_t *rb)
+{
+    memset (rb->data, 0, sizeof (sample_t) * rb->size);
+    rb->write_pos = 0;
+    rb->reserve_pos = 0;
+}
+
+size_t
+ringbuf_write_begin (ringbuf_t *rb, size_t n)
+{
+    // only the producer modifies the positions, no need for atomic loads here
+    size_t pos = rb->write_pos;
+    __atomic_store_n (&rb->reserve_pos, pos + n, __ATOMIC_RELAXED);
+    // readers must see the reservation before any of the new samples
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    return pos;
+}
+
+void
+ringbuf_write_commit (ringbuf_t *rb, size_t n)
+{
+    __atomic_store_n (&rb->write_pos, rb->write_pos + n, __ATOMIC_RELEASE);
+}
+
+void
+ringbuf_write (ringbuf_t *rb, const sample_t *src, size_t n)
+{
+    if (n > rb->size) {
+        src += n - rb->size;
+        n = rb->size;
+    }
+    size_t pos = ringbuf_write_begin (rb, n);
+    size_t offset = pos & rb->mask;
+    size_t n1 = rb->size - offset;
+    if (n1 > n) {
+        n1 = n;
+    }
+    memcpy (rb->data + offset, src, n1 * sizeof (sample_t));
+    memcpy (rb->data, src + n1, (n - n1) * sizeof (sample_t));
+    ringbuf_write_commit (rb, n);
+}
+
+void
+ringbuf_skip_to (ringbuf_t *rb, size_t pos)
+{
+    if (pos <= rb->write_pos) {
+        return;
+    }
+    size_t n = pos - rb->write_pos;
+    size_t start = ringbuf_write_begin (rb, n);
+    // only the last size samples survive anyway
+    if (n > rb->size) {
+        start += n - rb->size;
+    }
+    for (size_t i = start; i < pos; i++) {
+        rb->data[i & rb->mask] = 0;
+    }
+    ringbuf_write_commit (rb, n);
+}
+
+size_t
+ringbuf_write_pos (ringbuf_t *rb)
+{
+    return __atomic_load_n (&rb->write_pos, __ATOMIC_ACQUIRE);
+}
+
+int
+ringbuf_read (ringbuf_t *rb, sample_t *dst, size_t end, size_t n)
+{
+    if (n > rb->size || end > ringbuf_write_pos (rb)) {
+        return -1;
+    }
+    size_t offset = (end - n) & rb->mask;
+    size_t n1 = rb->size - offset;
+    if (n1 > n) {
+        n1 = n;
+    }
+    memcpy (dst, rb->data + offset, n1 * sizeof (sample_t));
+    memcpy (dst + n1, rb->data, (n - n1) * sizeof (sample_t));
+
+    // the copy must be complete before we look at how far the producer got
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    size_t reserve = __atomic_load_n (&rb->reserve_pos, __ATOMIC_RELAXED);
+    if (reserve - end > rb->size - n) {
+        // overwritten while copying
+        return -1;
+    }
+    return 0;
+}
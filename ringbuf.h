@@ -0,0 +1,97 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __RINGBUF_H
+#define __RINGBUF_H
+
+#include <stddef.h>
+
+#include "fft.h"
+
+/* Lock-free single-producer ring buffer.
+ *
+ * Positions are absolute sample counts since ringbuf_init. The producer only
+ * ever appends and never waits, old samples are simply overwritten. Readers
+ * copy any window that ends at or before the published write position and
+ * validate it afterwards: if the producer lapped the window while it was
+ * being copied the read fails instead of returning torn data. Readers don't
+ * modify the buffer, so any number of them can follow the same producer. */
+typedef struct {
+    sample_t *data;
+    size_t size;
+    size_t mask;
+    // end of the published (readable) samples
+    size_t write_pos;
+    // end of the region the producer is currently writing to
+    size_t reserve_pos;
+} ringbuf_t;
+
+// size is rounded up to the next power of two
+int
+ringbuf_init (ringbuf_t *rb, size_t size);
+
+void
+ringbuf_free (ringbuf_t *rb);
+
+// back to position 0 and silence, keeping the allocation. Not safe while
+// anyone else uses the ring.
+void
+ringbuf_reset (ringbuf_t *rb);
+
+// producer: announce n new samples, returns the position of the first one
+size_t
+ringbuf_write_begin (ringbuf_t *rb, size_t n);
+
+// producer: publish the n samples announced by ringbuf_write_begin
+void
+ringbuf_write_commit (ringbuf_t *rb, size_t n);
+
+// producer: begin, copy and commit in one go
+void
+ringbuf_write (ringbuf_t *rb, const sample_t *src, size_t n);
+
+// producer: fill with silence up to absolute position pos, used to keep
+// several rings at the same position
+void
+ringbuf_skip_to (ringbuf_t *rb, size_t pos);
+
+static inline sample_t *
+ringbuf_slot (ringbuf_t *rb, size_t pos)
+{
+    return &rb->data[pos & rb->mask];
+}
+
+// producer: samples that can be written at pos before the ring wraps
+static inline size_t
+ringbuf_contiguous (ringbuf_t *rb, size_t pos)
+{
+    return rb->size - (pos & rb->mask);
+}
+
+// consumer: current end of readable data
+size_t
+ringbuf_write_pos (ringbuf_t *rb);
+
+// consumer: copy the n samples ending at absolute position end into dst.
+// Returns 0 on success, -1 if the window isn't available (yet or anymore).
+int
+ringbuf_read (ringbuf_t *rb, sample_t *dst, size_t end, size_t n);
+
+#endif
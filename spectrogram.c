@@ -25,21 +25,74 @@
 #include <assert.h>
 #include <math.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 #include <gtk/gtk.h>
-#include <fftw3.h>
 
 #include <deadbeef/deadbeef.h>
 #include <deadbeef/gtkui_api.h>
 
+#include "cache.h"
 #include "fastftoi.h"
-
-#define GRADIENT_TABLE_SIZE 2048
-#define FFT_SIZE 8192
-#define MAX_HEIGHT 4096
-
-#define     CONFSTR_SP_LOG_SCALE              "spectrogram.log_scale"
+#include "fft.h"
+#include "history.h"
+#include "kernels.h"
+#include "offline.h"
+#include "profile.h"
+#include "raster.h"
+#include "ringbuf.h"
+#include "stft.h"
+
+#define MIN_FFT_SIZE 512
+#define MAX_FFT_SIZE 65536
+// samples between two consecutive spectrogram columns
+#define MIN_HOP_SIZE 256
+#define MAX_HOP_SIZE 4096
+// columns the analysis thread can be ahead of the GTK thread
+#define MAX_QUEUED_COLUMNS 128
+// whole track mode keeps a byte per bin of every column around
+#define MAX_OFFLINE_FFT_SIZE 8192
+// samples between two whole track columns, whatever the widget's width;
+// part of the cache key
+#define OFFLINE_HOP_SIZE 4096
+// whole track mode waits until the widget's size or the track stopped
+// changing for this long (us) before it draws the image again or restarts
+// the analysis
+#define OFFLINE_SETTLE_TIME 150000
+// whole track cache limit, see cache.h
+#define MAX_CACHE_MB 16384
+// scrollback limits, see history.h
+#define MAX_HISTORY_MINUTES 60
+#define MAX_HISTORY_MB 1024
+// constant-Q resolution limit, see cqt.h
+#define MAX_CQT_BINS_PER_OCTAVE 96
+// multi-resolution crossover limits in Hz, see stft_set_bands
+#define MIN_CROSSOVER 50
+#define MAX_CROSSOVER 20000
+// limit of the shown frequency range in Hz
+#define MAX_DISPLAY_FREQ 96000
+
+// RASTER_SCALE_*, the key of the former log scale checkbox
+#define     CONFSTR_SP_FREQ_SCALE             "spectrogram.log_scale"
 #define     CONFSTR_SP_REFRESH_INTERVAL       "spectrogram.refresh_interval"
 #define     CONFSTR_SP_DB_RANGE               "spectrogram.db_range"
+#define     CONFSTR_SP_HOP_SIZE               "spectrogram.hop_size"
+#define     CONFSTR_SP_FFT_PATIENT            "spectrogram.fft_patient"
+#define     CONFSTR_SP_FFT_SIZE               "spectrogram.fft_size"
+#define     CONFSTR_SP_CHANNEL_MODE           "spectrogram.channel_mode"
+#define     CONFSTR_SP_DOWNMIX                "spectrogram.downmix"
+#define     CONFSTR_SP_DOWNMIX_CHANNEL        "spectrogram.downmix_channel"
+#define     CONFSTR_SP_WHOLE_TRACK            "spectrogram.whole_track"
+#define     CONFSTR_SP_PROFILE_LOG            "spectrogram.profile_log"
+#define     CONFSTR_SP_HISTORY_MINUTES        "spectrogram.history_minutes"
+#define     CONFSTR_SP_HISTORY_MB             "spectrogram.history_mb"
+#define     CONFSTR_SP_CACHE_MB               "spectrogram.cache_mb"
+#define     CONFSTR_SP_CQT_BINS_PER_OCTAVE    "spectrogram.cqt_bins_per_octave"
+#define     CONFSTR_SP_MULTIRES               "spectrogram.multires"
+#define     CONFSTR_SP_CROSSOVER_LOW          "spectrogram.crossover_low"
+#define     CONFSTR_SP_CROSSOVER_HIGH         "spectrogram.crossover_high"
+#define     CONFSTR_SP_MIN_FREQ               "spectrogram.min_freq"
+#define     CONFSTR_SP_MAX_FREQ               "spectrogram.max_freq"
 #define     CONFSTR_SP_NUM_COLORS             "spectrogram.num_colors"
 #define     CONFSTR_SP_COLOR_GRADIENT_00      "spectrogram.color.gradient_00"
 #define     CONFSTR_SP_COLOR_GRADIENT_01      "spectrogram.color.gradient_01"
@@ -54,45 +107,180 @@ static DB_misc_t            plugin;
 static DB_functions_t *     deadbeef = NULL;
 static ddb_gtkui_t *        gtkui_plugin = NULL;
 
-typedef struct {
+typedef struct w_spectrogram_s {
     ddb_gtkui_widget_t base;
     GtkWidget *drawarea;
     GtkWidget *popup;
     GtkWidget *popup_item;
+    GtkWidget *whole_track_item;
+#ifdef ENABLE_PROFILING
+    GtkWidget *stats_item;
+    int show_stats;
+#endif
+    // tick callback (GTK3) or timeout (GTK2) that redraws while there is
+    // something new to draw, 0 when idle
     guint drawtimer;
-    double *data;
-    double window[FFT_SIZE];
-    double *in;
-    //double *out_real;
-    fftw_complex *out_complex;
-    fftw_plan p_r2c;
-    //fftw_plan p_r2r;
-    uint32_t colors[GRADIENT_TABLE_SIZE];
-    double *samples;
-    int *log_index;
-    float samplerate;
-    int height;
-    int low_res_end;
+    // the widget is on screen and follows the engine: it's mapped and
+    // not hidden, i.e. fully obscured (GTK2) or its window is minimised or
+    // withdrawn (GTK3)
+    int active;
+    int mapped;
+    int hidden;
+    // set when new columns were queued since the last frame
+    int columns_ready;
+    // all widgets, see spectrogram_columns_ready
+    struct w_spectrogram_s *next;
+    // the column being drawn, copied out of the engine's column queue
+    sample_t *data;
+    // turns columns into pixels, see raster.h
+    raster_t *raster;
+    // set when the colours or the scale changed
+    int recolor;
     int resized;
-    int buffered;
-    intptr_t mutex;
+    // our read position in the engine's column queue
+    size_t columns_pos;
+    int generation;
+    // FFT size of the columns we're drawing
+    int fft_size;
+    // constant-Q bins per lane, 0 for FFT bins
+    int cqt_bins;
+    // lanes in each column and distance between two columns
+    int lanes;
+    int column_size;
     cairo_surface_t *surf;
+    // surf is used as a ring of columns, this is the next one to be written
+    int cursor;
+    // the columns drawn into surf and older ones, to draw them again after
+    // a resize or a change of the colours, dB range or scale
+    history_t *history;
+    // set when surf has to be drawn again from the history
+    int live_stale;
+    // set after a seek, see spectrogram_live_seed
+    int live_seek;
+    // whole track mode: the job analysing the playing track, columns of
+    // OFFLINE_HOP_SIZE samples whatever the width. In live mode it only
+    // runs to fill the cache, the columns seed the history after a seek.
+    offline_job_t *offline;
+    // instead of the job: the track's columns from the cache
+    cache_t *offline_cache;
+    // the cache key of the track, path empty if it can't be cached; stored
+    // is set once the job's columns went to the cache
+    char offline_path[PATH_MAX];
+    int64_t offline_mtime;
+    int offline_fft_size;
+    int offline_stored;
+    // the image of the columns scaled to the widget's width, and which of
+    // its offline_width pixel columns are drawn already
+    cairo_surface_t *offline_surf;
+    uint8_t *offline_drawn;
+    int offline_width;
+    // set when the track changed or the image has to be drawn again
+    int offline_restart;
+    int offline_stale;
+    // when a requested restart or the image at the latest size are due
+    // (monotonic time), 0 if none is pending. The size is the one of the
+    // last frame.
+    gint64 offline_restart_at;
+    gint64 offline_resize_at;
+    int offline_size_width;
+    int offline_size_height;
 } w_spectrogram_t;
 
-
-static int CONFIG_LOG_SCALE = 1;
+/* Analysis engine, shared by all spectrogram widgets.
+ *
+ * It's refcounted by the widgets: the first one subscribes to the audio
+ * data and starts the analysis thread, the last one stops it again. The
+ * audio thread pushes into the STFT, the analysis thread pulls every hop
+ * out of it exactly once and queues the column; every widget follows the
+ * column queue with its own read position. */
+typedef struct {
+    int refcount;
+    intptr_t mutex;
+    intptr_t cond;
+    intptr_t worker;
+    int terminate;
+    float samplerate;
+    stft_t *stft;
+    // the STFT's setup of the queued columns
+    int fft_size;
+    int lanes;
+    // constant-Q and multi-resolution modes as configured, the sample rate
+    // the kernels and bands are made for and the constant-Q bins per lane
+    // (0 if off or failed)
+    int cqt_bins_per_octave;
+    int multires;
+    int crossover_low;
+    int crossover_high;
+    int max_freq;
+    float mode_samplerate;
+    int cqt_bins;
+    // finished columns (power spectra of fft_size/2 bins for every lane),
+    // filled by the analysis thread. Columns are column_size apart, which is
+    // lanes*bins rounded up to a power of two so that they never wrap.
+    // Replaced when the FFT size or the lanes change, which bumps the
+    // generation; widgets copy columns out under the mutex.
+    ringbuf_t columns;
+    int column_size;
+    int generation;
+    // set while the GTK thread has a notification about new columns queued,
+    // its idle source is only ever removed by data (see engine_release)
+    int notify;
+} analysis_engine_t;
+
+static analysis_engine_t engine;
+// widgets that exist, only used in the GTK thread
+static w_spectrogram_t *widgets;
+
+
+static int CONFIG_FREQ_SCALE = RASTER_SCALE_LOG;
 static int CONFIG_DB_RANGE = 70;
 static int CONFIG_NUM_COLORS = 7;
 static int CONFIG_REFRESH_INTERVAL = 25;
+static int CONFIG_HOP_SIZE = 1024;
+static int CONFIG_FFT_PATIENT = 0;
+static int CONFIG_FFT_SIZE = 8192;
+// what is analysed, one of the CHANNELS_* modes
+static int CONFIG_CHANNEL_MODE = CHANNELS_MIX;
+// how CHANNELS_MIX mixes, one of the DOWNMIX_* modes
+static int CONFIG_DOWNMIX = DOWNMIX_MEAN;
+// for DOWNMIX_CHANNEL, 0 based
+static int CONFIG_DOWNMIX_CHANNEL = 0;
+// show the whole playing track instead of the live view
+static int CONFIG_WHOLE_TRACK = 0;
+// scrollback of the live view, whichever limit is hit first
+static int CONFIG_HISTORY_MINUTES = 5;
+static int CONFIG_HISTORY_MB = 64;
+// size limit of the whole track cache, 0 turns it off
+static int CONFIG_CACHE_MB = 256;
+// 0 shows the FFT bins
+static int CONFIG_CQT_BINS_PER_OCTAVE = 0;
+// several FFT sizes split at the crossovers (Hz), unless constant-Q is on
+static int CONFIG_MULTIRES = 0;
+static int CONFIG_CROSSOVER_LOW = 500;
+static int CONFIG_CROSSOVER_HIGH = 4000;
+// shown frequency range in Hz, 0 for everything up to the Nyquist frequency.
+// Nothing above max_freq is analysed, see stft_set_bands.
+static int CONFIG_MIN_FREQ = 0;
+static int CONFIG_MAX_FREQ = 0;
+#ifdef ENABLE_PROFILING
+// append the timing stats to spectrogram_profile.log every second
+static int CONFIG_PROFILE_LOG = 0;
+#endif
 static GdkColor CONFIG_GRADIENT_COLORS[7];
 
 static void
 save_config (void)
 {
-    deadbeef->conf_set_int (CONFSTR_SP_LOG_SCALE, CONFIG_LOG_SCALE);
+    deadbeef->conf_set_int (CONFSTR_SP_FREQ_SCALE, CONFIG_FREQ_SCALE);
     deadbeef->conf_set_int (CONFSTR_SP_DB_RANGE, CONFIG_DB_RANGE);
     deadbeef->conf_set_int (CONFSTR_SP_NUM_COLORS, CONFIG_NUM_COLORS);
     deadbeef->conf_set_int (CONFSTR_SP_REFRESH_INTERVAL, CONFIG_REFRESH_INTERVAL);
+    deadbeef->conf_set_int (CONFSTR_SP_HOP_SIZE, CONFIG_HOP_SIZE);
+    deadbeef->conf_set_int (CONFSTR_SP_FFT_SIZE, CONFIG_FFT_SIZE);
+    deadbeef->conf_set_int (CONFSTR_SP_CHANNEL_MODE, CONFIG_CHANNEL_MODE);
+    deadbeef->conf_set_int (CONFSTR_SP_DOWNMIX, CONFIG_DOWNMIX);
+    deadbeef->conf_set_int (CONFSTR_SP_DOWNMIX_CHANNEL, CONFIG_DOWNMIX_CHANNEL);
+    deadbeef->conf_set_int (CONFSTR_SP_WHOLE_TRACK, CONFIG_WHOLE_TRACK);
     char color[100];
     snprintf (color, sizeof (color), "%d %d %d", CONFIG_GRADIENT_COLORS[0].red, CONFIG_GRADIENT_COLORS[0].green, CONFIG_GRADIENT_COLORS[0].blue);
     deadbeef->conf_set_str (CONFSTR_SP_COLOR_GRADIENT_00, color);
@@ -114,10 +302,47 @@ static void
 load_config (void)
 {
     deadbeef->conf_lock ();
-    CONFIG_LOG_SCALE = deadbeef->conf_get_int (CONFSTR_SP_LOG_SCALE,                1);
+    CONFIG_FREQ_SCALE = deadbeef->conf_get_int (CONFSTR_SP_FREQ_SCALE,              RASTER_SCALE_LOG);
+    CONFIG_FREQ_SCALE = CLAMP (CONFIG_FREQ_SCALE, RASTER_SCALE_LINEAR, RASTER_SCALE_BARK);
     CONFIG_DB_RANGE = deadbeef->conf_get_int (CONFSTR_SP_DB_RANGE,                 70);
     CONFIG_NUM_COLORS = deadbeef->conf_get_int (CONFSTR_SP_NUM_COLORS,              7);
     CONFIG_REFRESH_INTERVAL = deadbeef->conf_get_int (CONFSTR_SP_REFRESH_INTERVAL, 25);
+    CONFIG_HOP_SIZE = deadbeef->conf_get_int (CONFSTR_SP_HOP_SIZE,              1024);
+    CONFIG_HOP_SIZE = CLAMP (CONFIG_HOP_SIZE, MIN_HOP_SIZE, MAX_HOP_SIZE);
+    CONFIG_FFT_PATIENT = deadbeef->conf_get_int (CONFSTR_SP_FFT_PATIENT,         0);
+    int fft_size = deadbeef->conf_get_int (CONFSTR_SP_FFT_SIZE,                  8192);
+    // only powers of two
+    CONFIG_FFT_SIZE = MIN_FFT_SIZE;
+    while (CONFIG_FFT_SIZE < fft_size && CONFIG_FFT_SIZE < MAX_FFT_SIZE) {
+        CONFIG_FFT_SIZE <<= 1;
+    }
+    CONFIG_CHANNEL_MODE = deadbeef->conf_get_int (CONFSTR_SP_CHANNEL_MODE,       CHANNELS_MIX);
+    CONFIG_CHANNEL_MODE = CLAMP (CONFIG_CHANNEL_MODE, CHANNELS_MIX, CHANNELS_MID_SIDE);
+    CONFIG_DOWNMIX = deadbeef->conf_get_int (CONFSTR_SP_DOWNMIX,                 DOWNMIX_MEAN);
+    CONFIG_DOWNMIX = CLAMP (CONFIG_DOWNMIX, DOWNMIX_MEAN, DOWNMIX_CHANNEL);
+    CONFIG_DOWNMIX_CHANNEL = deadbeef->conf_get_int (CONFSTR_SP_DOWNMIX_CHANNEL,   0);
+    CONFIG_DOWNMIX_CHANNEL = CLAMP (CONFIG_DOWNMIX_CHANNEL, 0, STFT_MAX_LANES-1);
+    CONFIG_WHOLE_TRACK = deadbeef->conf_get_int (CONFSTR_SP_WHOLE_TRACK,         0);
+    CONFIG_HISTORY_MINUTES = deadbeef->conf_get_int (CONFSTR_SP_HISTORY_MINUTES, 5);
+    CONFIG_HISTORY_MINUTES = CLAMP (CONFIG_HISTORY_MINUTES, 0, MAX_HISTORY_MINUTES);
+    CONFIG_HISTORY_MB = deadbeef->conf_get_int (CONFSTR_SP_HISTORY_MB,           64);
+    CONFIG_HISTORY_MB = CLAMP (CONFIG_HISTORY_MB, 1, MAX_HISTORY_MB);
+    CONFIG_CACHE_MB = deadbeef->conf_get_int (CONFSTR_SP_CACHE_MB,               256);
+    CONFIG_CACHE_MB = CLAMP (CONFIG_CACHE_MB, 0, MAX_CACHE_MB);
+    CONFIG_CQT_BINS_PER_OCTAVE = deadbeef->conf_get_int (CONFSTR_SP_CQT_BINS_PER_OCTAVE, 0);
+    CONFIG_CQT_BINS_PER_OCTAVE = CLAMP (CONFIG_CQT_BINS_PER_OCTAVE, 0, MAX_CQT_BINS_PER_OCTAVE);
+    CONFIG_MULTIRES = deadbeef->conf_get_int (CONFSTR_SP_MULTIRES,               0);
+    CONFIG_CROSSOVER_LOW = deadbeef->conf_get_int (CONFSTR_SP_CROSSOVER_LOW,     500);
+    CONFIG_CROSSOVER_LOW = CLAMP (CONFIG_CROSSOVER_LOW, MIN_CROSSOVER, MAX_CROSSOVER);
+    CONFIG_CROSSOVER_HIGH = deadbeef->conf_get_int (CONFSTR_SP_CROSSOVER_HIGH,   4000);
+    CONFIG_CROSSOVER_HIGH = CLAMP (CONFIG_CROSSOVER_HIGH, CONFIG_CROSSOVER_LOW, MAX_CROSSOVER);
+    CONFIG_MIN_FREQ = deadbeef->conf_get_int (CONFSTR_SP_MIN_FREQ,               0);
+    CONFIG_MIN_FREQ = CLAMP (CONFIG_MIN_FREQ, 0, MAX_DISPLAY_FREQ);
+    CONFIG_MAX_FREQ = deadbeef->conf_get_int (CONFSTR_SP_MAX_FREQ,               0);
+    CONFIG_MAX_FREQ = CLAMP (CONFIG_MAX_FREQ, 0, MAX_DISPLAY_FREQ);
+#ifdef ENABLE_PROFILING
+    CONFIG_PROFILE_LOG = deadbeef->conf_get_int (CONFSTR_SP_PROFILE_LOG,         0);
+#endif
     const char *color;
     color = deadbeef->conf_get_str_fast (CONFSTR_SP_COLOR_GRADIENT_00,        "65535 0 0");
     sscanf (color, "%hd %hd %hd", &(CONFIG_GRADIENT_COLORS[0].red), &(CONFIG_GRADIENT_COLORS[0].green), &(CONFIG_GRADIENT_COLORS[0].blue));
@@ -136,88 +361,298 @@ load_config (void)
     deadbeef->conf_unlock ();
 }
 
-void
-do_fft (w_spectrogram_t *w)
+// the settings an engine_configure was asked for
+typedef struct {
+    int fft_size;
+    int lanes;
+    int cqt_bins_per_octave;
+    int multires;
+    int crossover_low;
+    int crossover_high;
+    int max_freq;
+    float samplerate;
+} engine_setup_t;
+
+static int
+engine_setup_equal (const engine_setup_t *a, const engine_setup_t *b)
 {
-    if (!w->samples || w->buffered < FFT_SIZE/2) {
-        return;
-    }
-    deadbeef->mutex_lock (w->mutex);
-    double real,imag;
+    return a->fft_size == b->fft_size && a->lanes == b->lanes
+        && a->cqt_bins_per_octave == b->cqt_bins_per_octave && a->multires == b->multires
+        && a->crossover_low == b->crossover_low && a->crossover_high == b->crossover_high
+        && a->max_freq == b->max_freq && a->samplerate == b->samplerate;
+}
 
-    for (int i = 0; i < FFT_SIZE; i++) {
-        w->in[i] = w->samples[i] * w->window[i];
+/* (Re)plan the STFT for a new FFT size or number of lanes. Only called
+ * from the analysis thread, which is the STFT's consumer; the column queue
+ * is read by the widgets and is swapped under the engine mutex. The audio
+ * thread is never affected, the STFT's rings are big enough for the largest
+ * FFT size and all lanes. */
+static int
+engine_configure (analysis_engine_t *e, int fft_size, int lanes, int cqt_bins_per_octave, int multires)
+{
+    int column_size = fft_size/2;
+    while (column_size < fft_size/2 * lanes) {
+        column_size <<= 1;
     }
-    deadbeef->mutex_unlock (w->mutex);
-    //fftw_execute (w->p_r2r);
-    fftw_execute (w->p_r2c);
-    for (int i = 0; i < FFT_SIZE/2; i++)
-    {
-        real = w->out_complex[i][0];
-        imag = w->out_complex[i][1];
-        w->data[i] = (real*real + imag*imag);
-        //w->data[i] = w->out_real[i]*w->out_real[i] + w->out_real[FFT_SIZE/2+i]*w->out_real[FFT_SIZE/2+i];
+    ringbuf_t columns;
+    if (ringbuf_init (&columns, column_size * MAX_QUEUED_COLUMNS) < 0) {
+        return -1;
+    }
+    // measuring takes a while for sizes we have no wisdom for yet, which is
+    // why the plan is made here rather than in the GTK thread
+    if (stft_configure (e->stft, fft_size, lanes, CONFIG_FFT_PATIENT ? FFTW_PATIENT : FFTW_MEASURE) < 0) {
+        ringbuf_free (&columns);
+        return -1;
+    }
+    // the kernels and band plans take a moment too; without them the FFT
+    // bins are shown
+    float samplerate = e->samplerate;
+    int crossover_low = CONFIG_CROSSOVER_LOW;
+    int crossover_high = CONFIG_CROSSOVER_HIGH;
+    int max_freq = CONFIG_MAX_FREQ;
+    if (cqt_bins_per_octave > 0) {
+        stft_set_cqt (e->stft, samplerate, cqt_bins_per_octave);
+    }
+    else if (multires || max_freq > 0) {
+        // a low max_freq decimates in front of the FFT
+        float crossovers[2] = { crossover_low, crossover_high };
+        stft_set_bands (e->stft, samplerate, crossovers, multires ? 2 : 0, max_freq);
     }
-}
 
-static inline void
-_draw_point (uint8_t *data, int stride, int x0, int y0, uint32_t color) {
-    uint32_t *ptr = (uint32_t*)&data[y0*stride+x0*4];
-    *ptr = color;
+    deadbeef->mutex_lock (e->mutex);
+    ringbuf_t old = e->columns;
+    e->columns = columns;
+    e->fft_size = fft_size;
+    e->lanes = lanes;
+    e->cqt_bins_per_octave = cqt_bins_per_octave;
+    e->multires = multires;
+    e->crossover_low = crossover_low;
+    e->crossover_high = crossover_high;
+    e->max_freq = max_freq;
+    e->mode_samplerate = samplerate;
+    e->cqt_bins = stft_cqt_bins (e->stft);
+    e->column_size = column_size;
+    e->generation++;
+    deadbeef->mutex_unlock (e->mutex);
+    ringbuf_free (&old);
+    return 0;
 }
 
-/* based on Delphi function by Witold J.Janik */
-void
-create_gradient_table (gpointer user_data, GdkColor *colors, int num_colors)
+static void
+spectrogram_wake (w_spectrogram_t *w);
+
+// GTK thread: new columns are queued, get the widgets going
+static gboolean
+spectrogram_columns_ready (gpointer user_data)
 {
-    w_spectrogram_t *w = user_data;
+    analysis_engine_t *e = user_data;
+    // cleared first, so that columns queued from now on notify again
+    __atomic_store_n (&e->notify, 0, __ATOMIC_RELEASE);
+    for (w_spectrogram_t *w = widgets; w; w = w->next) {
+        __atomic_store_n (&w->columns_ready, 1, __ATOMIC_RELAXED);
+        spectrogram_wake (w);
+    }
+    return FALSE;
+}
 
-    num_colors -= 1;
+#ifdef ENABLE_PROFILING
+// append the stats of the last second to the log, at most once a second.
+// Called from the analysis thread, so that the log goes on while the
+// widgets are hidden and the file isn't written in the GTK thread.
+static void
+spectrogram_log_stats (void)
+{
+    static uint64_t last_dump = 0;
+    uint64_t now = profile_now ();
+    if (!CONFIG_PROFILE_LOG || now - last_dump < 1000000000) {
+        return;
+    }
+    last_dump = now;
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/spectrogram_profile.log", deadbeef->get_config_dir ());
+    FILE *f = fopen (path, "a");
+    if (!f) {
+        return;
+    }
+    fprintf (f, "# %lld\n", (long long)time (NULL));
+    profile_dump (f);
+    fclose (f);
+}
+#endif
 
-    for (int i = 0; i < GRADIENT_TABLE_SIZE; i++) {
-        double position = (double)i/GRADIENT_TABLE_SIZE;
-        /* if position > 1 then we have repetition of colors it maybe useful    */
-        if (position > 1.0) {
-            if (position - ftoi (position) == 0.0) {
-                position = 1.0;
-            }
-            else {
-                position = position - ftoi (position);
+static void
+spectrogram_analysis_thread (void *ctx)
+{
+    analysis_engine_t *e = ctx;
+    // a setup that couldn't be planned isn't tried again until the
+    // settings change, the previous one stays in use meanwhile
+    engine_setup_t failed = { 0 };
+    for (;;) {
+        int lanes = stft_input_lanes (e->stft);
+        int cqt = CONFIG_CQT_BINS_PER_OCTAVE;
+        int multires = CONFIG_MULTIRES;
+        engine_setup_t setup = {
+            .fft_size = CONFIG_FFT_SIZE,
+            .lanes = lanes,
+            .cqt_bins_per_octave = cqt,
+            .multires = multires,
+            .crossover_low = CONFIG_CROSSOVER_LOW,
+            .crossover_high = CONFIG_CROSSOVER_HIGH,
+            .max_freq = CONFIG_MAX_FREQ,
+            .samplerate = e->samplerate,
+        };
+        // the constant-Q kernels and the band edges depend on the sample rate
+        int mode_changed = e->cqt_bins_per_octave != cqt || e->multires != multires
+            || e->max_freq != CONFIG_MAX_FREQ
+            || ((cqt || multires || CONFIG_MAX_FREQ) && e->mode_samplerate != e->samplerate)
+            || (multires && (e->crossover_low != CONFIG_CROSSOVER_LOW || e->crossover_high != CONFIG_CROSSOVER_HIGH));
+        if ((e->fft_size != setup.fft_size || e->lanes != lanes || mode_changed)
+                && !engine_setup_equal (&setup, &failed)
+                && engine_configure (e, setup.fft_size, lanes, cqt, multires) < 0) {
+            if (!e->fft_size) {
+                // no plan at all, nothing we can do
+                break;
             }
+            failed = setup;
         }
-
-        double m= num_colors * position;
-        int n=(int)m; // integer of m
-        double f=m-n;  // fraction of m
-
-        w->colors[i] = 0xFF000000;
-        float scale = 255/65535.f;
-        if (num_colors == 0) {
-            w->colors[i] = ((uint32_t)(colors[0].red*scale) & 0xFF) << 16 |
-                ((uint32_t)(colors[0].green*scale) & 0xFF) << 8 |
-                ((uint32_t)(colors[0].blue*scale) & 0xFF) << 0;
+        // the hop size defines the time resolution, pick up changes between columns
+        int hop = CONFIG_HOP_SIZE;
+        deadbeef->mutex_lock (e->mutex);
+        while (!e->terminate && stft_pending (e->stft) < (size_t)hop) {
+            deadbeef->cond_wait (e->cond, e->mutex);
         }
-        else if (n < num_colors) {
-            w->colors[i] = ((uint32_t)((colors[n].red*scale) + f * ((colors[n+1].red*scale)-(colors[n].red*scale))) & 0xFF) << 16 |
-                ((uint32_t)((colors[n].green*scale) + f * ((colors[n+1].green*scale)-(colors[n].green*scale))) & 0xFF) << 8 |
-                ((uint32_t)((colors[n].blue*scale) + f * ((colors[n+1].blue*scale)-(colors[n].blue*scale))) & 0xFF) << 0;
+        int terminate = e->terminate;
+        deadbeef->mutex_unlock (e->mutex);
+        if (terminate) {
+            break;
         }
-        else if (n == num_colors) {
-            w->colors[i] = ((uint32_t)(colors[n].red*scale) & 0xFF) << 16 |
-                ((uint32_t)(colors[n].green*scale) & 0xFF) << 8 |
-                ((uint32_t)(colors[n].blue*scale) & 0xFF) << 0;
+
+        int produced = 0;
+        for (;;) {
+            if (!stft_pull (e->stft, hop)) {
+                break;
+            }
+            PROFILE_BEGIN (PROFILE_FFT);
+            // columns never wrap inside the ring, both sizes are powers of two
+            size_t start = ringbuf_write_begin (&e->columns, e->column_size);
+            stft_get_column (e->stft, ringbuf_slot (&e->columns, start));
+            ringbuf_write_commit (&e->columns, e->column_size);
+            PROFILE_END (PROFILE_FFT);
+            produced = 1;
         }
-        else {
-            w->colors[i] = 0xFFFFFFFF;
+        // one notification at a time, the widgets read everything there is
+        if (produced && !__atomic_exchange_n (&e->notify, 1, __ATOMIC_ACQ_REL)) {
+            g_idle_add (spectrogram_columns_ready, e);
+        }
+#ifdef ENABLE_PROFILING
+        spectrogram_log_stats ();
+#endif
+    }
+}
+
+static void
+spectrogram_wavedata_listener (void *ctx, ddb_audio_data_t *data) {
+    analysis_engine_t *e = ctx;
+    if (!e->stft) {
+        return;
+    }
+    e->samplerate = (float)data->fmt->samplerate;
+    stft_mix_t mix = {
+        .mode = CONFIG_CHANNEL_MODE,
+        .downmix = CONFIG_DOWNMIX,
+        .channel = CONFIG_DOWNMIX_CHANNEL,
+    };
+    PROFILE_BEGIN (PROFILE_LISTENER);
+    stft_push (e->stft, data->data, data->nframes, data->fmt->channels, &mix);
+    PROFILE_END (PROFILE_LISTENER);
+    // no lock here, a missed wakeup only delays analysis until the next callback
+    deadbeef->cond_signal (e->cond);
+}
+
+// widgets are only created and destroyed in the GTK thread, the engine
+// mutex is only needed for the analysis thread
+static void
+engine_acquire (void)
+{
+    analysis_engine_t *e = &engine;
+    if (e->refcount++ > 0) {
+        return;
+    }
+    deadbeef->mutex_lock (e->mutex);
+    e->samplerate = 44100.0;
+    // sized for the largest FFT and all lanes, so that changing the FFT size
+    // or the channel mode never has to touch anything the audio thread uses
+    e->stft = stft_new (MAX_FFT_SIZE);
+    e->fft_size = 0;
+    e->lanes = 0;
+    e->cqt_bins_per_octave = 0;
+    e->multires = 0;
+    e->max_freq = 0;
+    e->cqt_bins = 0;
+    e->terminate = 0;
+    e->worker = e->stft ? deadbeef->thread_start (spectrogram_analysis_thread, e) : 0;
+    deadbeef->mutex_unlock (e->mutex);
+    deadbeef->vis_waveform_listen (e, spectrogram_wavedata_listener);
+}
+
+static void
+engine_release (void)
+{
+    analysis_engine_t *e = &engine;
+    if (--e->refcount > 0) {
+        return;
+    }
+    deadbeef->vis_waveform_unlisten (e);
+    if (e->worker) {
+        deadbeef->mutex_lock (e->mutex);
+        e->terminate = 1;
+        deadbeef->cond_signal (e->cond);
+        deadbeef->mutex_unlock (e->mutex);
+        deadbeef->thread_join (e->worker);
+        e->worker = 0;
+    }
+    // a notification for nobody, the worker is gone so none can follow
+    if (__atomic_exchange_n (&e->notify, 0, __ATOMIC_ACQUIRE)) {
+        while (g_idle_remove_by_data (e)) {
         }
     }
+    if (e->stft) {
+        stft_free (e->stft);
+        e->stft = NULL;
+    }
+    ringbuf_free (&e->columns);
+    e->fft_size = 0;
+    e->lanes = 0;
+}
+
+static inline void
+_draw_point (uint8_t *data, int stride, int x0, int y0, uint32_t color) {
+    uint32_t *ptr = (uint32_t*)&data[y0*stride+x0*4];
+    *ptr = color;
+}
+
+static void
+spectrogram_apply_colors (w_spectrogram_t *w)
+{
+    uint32_t colors[7];
+    float scale = 255/65535.f;
+    for (int i = 0; i < CONFIG_NUM_COLORS; i++) {
+        colors[i] = ((uint32_t)(CONFIG_GRADIENT_COLORS[i].red*scale) & 0xFF) << 16 |
+            ((uint32_t)(CONFIG_GRADIENT_COLORS[i].green*scale) & 0xFF) << 8 |
+            ((uint32_t)(CONFIG_GRADIENT_COLORS[i].blue*scale) & 0xFF) << 0;
+    }
+    raster_set_gradient (w->raster, colors, CONFIG_NUM_COLORS);
+    raster_set_db_range (w->raster, CONFIG_DB_RANGE);
+    raster_set_range (w->raster, CONFIG_MIN_FREQ, CONFIG_MAX_FREQ);
 }
 
 static int
 on_config_changed (gpointer user_data, uintptr_t ctx)
 {
-    create_gradient_table (user_data, CONFIG_GRADIENT_COLORS, CONFIG_NUM_COLORS);
+    w_spectrogram_t *w = user_data;
     load_config ();
+    // applied with the next frame, in the GTK thread
+    __atomic_store_n (&w->recolor, 1, __ATOMIC_RELAXED);
     return 0;
 }
 
@@ -238,6 +673,12 @@ gtk_widget_get_allocation (GtkWidget *widget, GtkAllocation *allocation) {
 #define gtk_widget_set_can_default(widget, candefault) {if (candefault) GTK_WIDGET_SET_FLAGS (widget, GTK_CAN_DEFAULT); else GTK_WIDGET_UNSET_FLAGS(widget, GTK_CAN_DEFAULT);}
 #endif
 
+#if !GTK_CHECK_VERSION(2,24,0)
+#define GTK_COMBO_BOX_TEXT GTK_COMBO_BOX
+#define gtk_combo_box_text_new gtk_combo_box_new_text
+#define gtk_combo_box_text_append_text gtk_combo_box_append_text
+#endif
+
 static void
 on_button_config (GtkMenuItem *menuitem, gpointer user_data)
 {
@@ -259,9 +700,24 @@ on_button_config (GtkMenuItem *menuitem, gpointer user_data)
     GtkWidget *color_gradient_06;
     GtkWidget *num_colors_label;
     GtkWidget *num_colors;
-    GtkWidget *log_scale;
+    GtkWidget *hbox08;
+    GtkWidget *freq_scale_label;
+    GtkWidget *freq_scale;
     GtkWidget *db_range_label0;
     GtkWidget *db_range;
+    GtkWidget *hbox04;
+    GtkWidget *hop_size_label;
+    GtkWidget *hop_size;
+    GtkWidget *hbox05;
+    GtkWidget *fft_size_label;
+    GtkWidget *fft_size;
+    GtkWidget *hbox06;
+    GtkWidget *channel_mode_label;
+    GtkWidget *channel_mode;
+    GtkWidget *hbox07;
+    GtkWidget *downmix_label;
+    GtkWidget *downmix;
+    GtkWidget *downmix_channel;
     GtkWidget *dialog_action_area13;
     GtkWidget *applybutton1;
     GtkWidget *cancelbutton1;
@@ -369,9 +825,94 @@ on_button_config (GtkMenuItem *menuitem, gpointer user_data)
     gtk_widget_show (db_range);
     gtk_box_pack_start (GTK_BOX (hbox03), db_range, TRUE, TRUE, 0);
 
-    log_scale = gtk_check_button_new_with_label ("Log scale");
-    gtk_widget_show (log_scale);
-    gtk_box_pack_start (GTK_BOX (vbox01), log_scale, FALSE, FALSE, 0);
+    hbox04 = gtk_hbox_new (FALSE, 8);
+    gtk_widget_show (hbox04);
+    gtk_box_pack_start (GTK_BOX (vbox01), hbox04, FALSE, FALSE, 0);
+
+    hop_size_label = gtk_label_new (NULL);
+    gtk_label_set_markup (GTK_LABEL (hop_size_label),"Hop size (samples):");
+    gtk_widget_show (hop_size_label);
+    gtk_box_pack_start (GTK_BOX (hbox04), hop_size_label, FALSE, TRUE, 0);
+
+    hop_size = gtk_spin_button_new_with_range (MIN_HOP_SIZE,MAX_HOP_SIZE,256);
+    gtk_widget_show (hop_size);
+    gtk_box_pack_start (GTK_BOX (hbox04), hop_size, TRUE, TRUE, 0);
+
+    hbox05 = gtk_hbox_new (FALSE, 8);
+    gtk_widget_show (hbox05);
+    gtk_box_pack_start (GTK_BOX (vbox01), hbox05, FALSE, FALSE, 0);
+
+    fft_size_label = gtk_label_new (NULL);
+    gtk_label_set_markup (GTK_LABEL (fft_size_label),"FFT size:");
+    gtk_widget_show (fft_size_label);
+    gtk_box_pack_start (GTK_BOX (hbox05), fft_size_label, FALSE, TRUE, 0);
+
+    fft_size = gtk_combo_box_text_new ();
+    for (int size = MIN_FFT_SIZE; size <= MAX_FFT_SIZE; size <<= 1) {
+        char text[10];
+        snprintf (text, sizeof (text), "%d", size);
+        gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (fft_size), text);
+    }
+    gtk_widget_show (fft_size);
+    gtk_box_pack_start (GTK_BOX (hbox05), fft_size, TRUE, TRUE, 0);
+
+    hbox06 = gtk_hbox_new (FALSE, 8);
+    gtk_widget_show (hbox06);
+    gtk_box_pack_start (GTK_BOX (vbox01), hbox06, FALSE, FALSE, 0);
+
+    channel_mode_label = gtk_label_new (NULL);
+    gtk_label_set_markup (GTK_LABEL (channel_mode_label),"Channels:");
+    gtk_widget_show (channel_mode_label);
+    gtk_box_pack_start (GTK_BOX (hbox06), channel_mode_label, FALSE, TRUE, 0);
+
+    // same order as the CHANNELS_* modes
+    channel_mode = gtk_combo_box_text_new ();
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (channel_mode), "Mix");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (channel_mode), "Separate");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (channel_mode), "Mid/Side");
+    gtk_widget_show (channel_mode);
+    gtk_box_pack_start (GTK_BOX (hbox06), channel_mode, TRUE, TRUE, 0);
+
+    hbox07 = gtk_hbox_new (FALSE, 8);
+    gtk_widget_show (hbox07);
+    gtk_box_pack_start (GTK_BOX (vbox01), hbox07, FALSE, FALSE, 0);
+
+    downmix_label = gtk_label_new (NULL);
+    gtk_label_set_markup (GTK_LABEL (downmix_label),"Mix:");
+    gtk_widget_show (downmix_label);
+    gtk_box_pack_start (GTK_BOX (hbox07), downmix_label, FALSE, TRUE, 0);
+
+    // same order as the DOWNMIX_* modes
+    downmix = gtk_combo_box_text_new ();
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (downmix), "Mono (mean)");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (downmix), "Mid");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (downmix), "Side");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (downmix), "Loudest channel");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (downmix), "Single channel");
+    gtk_widget_show (downmix);
+    gtk_box_pack_start (GTK_BOX (hbox07), downmix, TRUE, TRUE, 0);
+
+    downmix_channel = gtk_spin_button_new_with_range (1,STFT_MAX_LANES,1);
+    gtk_widget_show (downmix_channel);
+    gtk_box_pack_start (GTK_BOX (hbox07), downmix_channel, FALSE, TRUE, 0);
+
+    hbox08 = gtk_hbox_new (FALSE, 8);
+    gtk_widget_show (hbox08);
+    gtk_box_pack_start (GTK_BOX (vbox01), hbox08, FALSE, FALSE, 0);
+
+    freq_scale_label = gtk_label_new (NULL);
+    gtk_label_set_markup (GTK_LABEL (freq_scale_label),"Frequency scale:");
+    gtk_widget_show (freq_scale_label);
+    gtk_box_pack_start (GTK_BOX (hbox08), freq_scale_label, FALSE, TRUE, 0);
+
+    // same order as the RASTER_SCALE_* scales
+    freq_scale = gtk_combo_box_text_new ();
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (freq_scale), "Linear");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (freq_scale), "Logarithmic");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (freq_scale), "Mel");
+    gtk_combo_box_text_append_text (GTK_COMBO_BOX_TEXT (freq_scale), "Bark");
+    gtk_widget_show (freq_scale);
+    gtk_box_pack_start (GTK_BOX (hbox08), freq_scale, TRUE, TRUE, 0);
 
     dialog_action_area13 = gtk_dialog_get_action_area (GTK_DIALOG (spectrogram_properties));
     gtk_widget_show (dialog_action_area13);
@@ -392,9 +933,14 @@ on_button_config (GtkMenuItem *menuitem, gpointer user_data)
     gtk_dialog_add_action_widget (GTK_DIALOG (spectrogram_properties), okbutton1, GTK_RESPONSE_OK);
     gtk_widget_set_can_default (okbutton1, TRUE);
 
-    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (log_scale), CONFIG_LOG_SCALE);
+    gtk_combo_box_set_active (GTK_COMBO_BOX (freq_scale), CONFIG_FREQ_SCALE);
     gtk_spin_button_set_value (GTK_SPIN_BUTTON (num_colors), CONFIG_NUM_COLORS);
     gtk_spin_button_set_value (GTK_SPIN_BUTTON (db_range), CONFIG_DB_RANGE);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (hop_size), CONFIG_HOP_SIZE);
+    gtk_combo_box_set_active (GTK_COMBO_BOX (fft_size), ftoi (log2f (CONFIG_FFT_SIZE/MIN_FFT_SIZE)));
+    gtk_combo_box_set_active (GTK_COMBO_BOX (channel_mode), CONFIG_CHANNEL_MODE);
+    gtk_combo_box_set_active (GTK_COMBO_BOX (downmix), CONFIG_DOWNMIX);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (downmix_channel), CONFIG_DOWNMIX_CHANNEL + 1);
     gtk_color_button_set_color (GTK_COLOR_BUTTON (color_gradient_00), &(CONFIG_GRADIENT_COLORS[0]));
     gtk_color_button_set_color (GTK_COLOR_BUTTON (color_gradient_01), &(CONFIG_GRADIENT_COLORS[1]));
     gtk_color_button_set_color (GTK_COLOR_BUTTON (color_gradient_02), &(CONFIG_GRADIENT_COLORS[2]));
@@ -473,8 +1019,13 @@ on_button_config (GtkMenuItem *menuitem, gpointer user_data)
             gtk_color_button_get_color (GTK_COLOR_BUTTON (color_gradient_05), &CONFIG_GRADIENT_COLORS[5]);
             gtk_color_button_get_color (GTK_COLOR_BUTTON (color_gradient_06), &CONFIG_GRADIENT_COLORS[6]);
 
-            CONFIG_LOG_SCALE = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (log_scale));
+            CONFIG_FREQ_SCALE = gtk_combo_box_get_active (GTK_COMBO_BOX (freq_scale));
             CONFIG_DB_RANGE = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (db_range));
+            CONFIG_HOP_SIZE = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (hop_size));
+            CONFIG_FFT_SIZE = MIN_FFT_SIZE << gtk_combo_box_get_active (GTK_COMBO_BOX (fft_size));
+            CONFIG_CHANNEL_MODE = gtk_combo_box_get_active (GTK_COMBO_BOX (channel_mode));
+            CONFIG_DOWNMIX = gtk_combo_box_get_active (GTK_COMBO_BOX (downmix));
+            CONFIG_DOWNMIX_CHANNEL = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (downmix_channel)) - 1;
             CONFIG_NUM_COLORS = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON (num_colors));
             switch (CONFIG_NUM_COLORS) {
                 case 1:
@@ -547,225 +1098,715 @@ on_button_config (GtkMenuItem *menuitem, gpointer user_data)
     return;
 }
 
+static void
+spectrogram_set_active (w_spectrogram_t *w, int active);
+
+#if GTK_CHECK_VERSION(3,0,0)
+static gboolean
+spectrogram_window_state_event (GtkWidget *widget, GdkEventWindowState *event, gpointer user_data);
+#endif
+
 void
 w_spectrogram_destroy (ddb_gtkui_widget_t *w) {
     w_spectrogram_t *s = (w_spectrogram_t *)w;
-    deadbeef->vis_waveform_unlisten (w);
+    for (w_spectrogram_t **p = &widgets; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    spectrogram_set_active (s, 0);
+#if GTK_CHECK_VERSION(3,0,0)
+    GtkWidget *toplevel = gtk_widget_get_toplevel (s->drawarea);
+    if (gtk_widget_is_toplevel (toplevel)) {
+        g_signal_handlers_disconnect_by_func (toplevel, spectrogram_window_state_event, s);
+    }
+#endif
     if (s->data) {
         free (s->data);
         s->data = NULL;
     }
-    if (s->samples) {
-        free (s->samples);
-        s->samples = NULL;
+    if (s->raster) {
+        raster_free (s->raster);
+        s->raster = NULL;
     }
-    if (s->log_index) {
-        free (s->log_index);
-        s->log_index = NULL;
+    if (s->surf) {
+        cairo_surface_destroy (s->surf);
+        s->surf = NULL;
     }
-    //if (s->p_r2r) {
-    //    fftw_destroy_plan (s->p_r2r);
-    //}
-    if (s->p_r2c) {
-        fftw_destroy_plan (s->p_r2c);
+    if (s->history) {
+        history_free (s->history);
+        s->history = NULL;
     }
-    if (s->in) {
-        fftw_free (s->in);
-        s->in = NULL;
+    if (s->offline) {
+        offline_job_free (s->offline);
+        s->offline = NULL;
     }
-    //if (s->out_real) {
-    //    fftw_free (s->out_real);
-    //    s->out_real = NULL;
-    //}
-    if (s->out_complex) {
-        fftw_free (s->out_complex);
-        s->out_complex = NULL;
+    if (s->offline_cache) {
+        cache_close (s->offline_cache);
+        s->offline_cache = NULL;
     }
-    if (s->drawtimer) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
+    if (s->offline_surf) {
+        cairo_surface_destroy (s->offline_surf);
+        s->offline_surf = NULL;
     }
-    if (s->surf) {
-        cairo_surface_destroy (s->surf);
-        s->surf = NULL;
+    if (s->offline_drawn) {
+        free (s->offline_drawn);
+        s->offline_drawn = NULL;
+    }
+}
+
+// anything to draw with the next frame
+static int
+spectrogram_pending (w_spectrogram_t *w)
+{
+    if (__atomic_load_n (&w->recolor, __ATOMIC_RELAXED)) {
+        return 1;
     }
-    if (s->mutex) {
-        deadbeef->mutex_free (s->mutex);
-        s->mutex = 0;
+    if (CONFIG_WHOLE_TRACK) {
+        // until the job's columns are all drawn and stored
+        return __atomic_load_n (&w->offline_restart, __ATOMIC_RELAXED) || w->offline_stale
+            || w->offline_restart_at || w->offline_resize_at || (w->offline && !w->offline_stored);
     }
+    return __atomic_load_n (&w->columns_ready, __ATOMIC_RELAXED) || w->live_stale
+        || __atomic_load_n (&w->live_seek, __ATOMIC_RELAXED) || __atomic_load_n (&w->offline_restart, __ATOMIC_RELAXED)
+        || w->offline_restart_at;
 }
 
-gboolean
-w_spectrogram_draw_cb (void *data) {
-    w_spectrogram_t *s = data;
-    gtk_widget_queue_draw (s->drawarea);
-    return TRUE;
+// once per frame while awake: draw if there is something new, otherwise go
+// to sleep until spectrogram_wake
+static gboolean
+spectrogram_frame (w_spectrogram_t *w)
+{
+    if (spectrogram_pending (w)) {
+        gtk_widget_queue_draw (w->drawarea);
+        return TRUE;
+    }
+    w->drawtimer = 0;
+    return FALSE;
 }
 
+#if GTK_CHECK_VERSION(3,8,0)
+static gboolean
+spectrogram_tick_cb (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+    return spectrogram_frame (user_data);
+}
+#else
+// without a frame clock, poll at the refresh interval instead
+static gboolean
+spectrogram_timeout_cb (gpointer user_data)
+{
+    return spectrogram_frame (user_data);
+}
+#endif
+
+// start redrawing, nothing happens while the widget isn't active
 static void
-spectrogram_wavedata_listener (void *ctx, ddb_audio_data_t *data) {
-    w_spectrogram_t *w = ctx;
-    if (!w->samples) {
+spectrogram_wake (w_spectrogram_t *w)
+{
+    if (!w->active || w->drawtimer) {
         return;
     }
-    deadbeef->mutex_lock (w->mutex);
-    w->samplerate = (float)data->fmt->samplerate;
-    int nsamples = data->nframes;
-    int sz = MIN (FFT_SIZE, nsamples);
-    int n = FFT_SIZE - sz;
-    memmove (w->samples, w->samples + sz, (FFT_SIZE - sz)*sizeof (double));
-
-    float pos = 0;
-    for (int i = 0; i < sz && pos < nsamples; i++, pos ++) {
-        w->samples[n+i] = -1000.0;
-        for (int j = 0; j < data->fmt->channels; j++) {
-            w->samples[n + i] = MAX (w->samples[n + i], data->data[ftoi (pos * data->fmt->channels) + j]);
+#if GTK_CHECK_VERSION(3,8,0)
+    w->drawtimer = gtk_widget_add_tick_callback (w->drawarea, spectrogram_tick_cb, w, NULL);
+#else
+    w->drawtimer = g_timeout_add (CONFIG_REFRESH_INTERVAL, spectrogram_timeout_cb, w);
+#endif
+}
+
+static void
+spectrogram_sleep (w_spectrogram_t *w)
+{
+    if (!w->drawtimer) {
+        return;
+    }
+#if GTK_CHECK_VERSION(3,8,0)
+    gtk_widget_remove_tick_callback (w->drawarea, w->drawtimer);
+#else
+    g_source_remove (w->drawtimer);
+#endif
+    w->drawtimer = 0;
+}
+
+/* Only active widgets analyse and draw: mapped ones whose window isn't
+ * minimised or withdrawn (GTK3) or that aren't fully obscured (GTK2). A
+ * GTK3 widget that is merely covered by other windows stays active. The
+ * engine runs as long as one widget is active, whole track jobs are stopped
+ * and started over when the widget comes back. */
+static void
+spectrogram_set_active (w_spectrogram_t *w, int active)
+{
+    if (active == w->active) {
+        return;
+    }
+    w->active = active;
+    if (active) {
+        engine_acquire ();
+        __atomic_store_n (&w->offline_restart, 1, __ATOMIC_RELAXED);
+        spectrogram_wake (w);
+        return;
+    }
+    spectrogram_sleep (w);
+    engine_release ();
+    if (w->offline) {
+        offline_job_free (w->offline);
+        w->offline = NULL;
+    }
+}
+
+// the lanes are stacked from top to bottom: left, right, ... or mid, side
+static void
+spectrogram_draw_column (w_spectrogram_t *w, uint8_t *data, int stride, int width, int height)
+{
+    int bins = w->fft_size/2;
+    int lane_height = raster_height (w->raster);
+    for (int l = 0; l < w->lanes; l++) {
+        // bottom row of the lane, drawn upwards
+        uint32_t *dst = (uint32_t *)(data + ((l+1) * lane_height - 1) * stride) + w->cursor;
+        raster_render_column (w->raster, w->data + l * bins, dst, -stride/4);
+    }
+    // rows that are left over below the last lane
+    for (int y = w->lanes * lane_height; y < height; y++) {
+        _draw_point (data, stride, w->cursor, y, raster_background (w->raster));
+    }
+    // no scrolling: just move on to the next column of the ring
+    w->cursor = (w->cursor + 1) % width;
+}
+
+// columns of scrollback for the current column layout and limits
+static int
+spectrogram_history_capacity (w_spectrogram_t *w)
+{
+    int values = w->fft_size/2 * w->lanes;
+    if (values <= 0) {
+        return 0;
+    }
+    int64_t by_time = (int64_t)CONFIG_HISTORY_MINUTES * 60 * engine.samplerate / CONFIG_HOP_SIZE;
+    int64_t by_memory = ((int64_t)CONFIG_HISTORY_MB << 20) / values;
+    return (int)CLAMP (MIN (by_time, by_memory), 1, INT_MAX);
+}
+
+// (re)create the scrollback, it starts out empty
+static void
+spectrogram_history_reset (w_spectrogram_t *w)
+{
+    if (w->history) {
+        history_free (w->history);
+        w->history = NULL;
+    }
+    int capacity = spectrogram_history_capacity (w);
+    if (capacity > 0) {
+        w->history = history_new (w->fft_size/2 * w->lanes, capacity);
+    }
+}
+
+// copy the next queued column into w->data, returns 0 if there is none
+static int
+spectrogram_next_column (w_spectrogram_t *w, int width)
+{
+    int res = 0;
+    int reset = 0;
+    __atomic_store_n (&w->columns_ready, 0, __ATOMIC_RELAXED);
+    PROFILE_BEGIN (PROFILE_LOCK);
+    deadbeef->mutex_lock (engine.mutex);
+    PROFILE_END (PROFILE_LOCK);
+    if (w->generation != engine.generation) {
+        // the FFT size, the lanes or the bins changed or the engine was
+        // restarted, the old queue is gone
+        reset = w->fft_size != engine.fft_size || w->lanes != engine.lanes || w->cqt_bins != engine.cqt_bins;
+        w->generation = engine.generation;
+        w->fft_size = engine.fft_size;
+        w->lanes = engine.lanes;
+        w->cqt_bins = engine.cqt_bins;
+        w->column_size = engine.column_size;
+        w->columns_pos = ringbuf_write_pos (&engine.columns);
+    }
+    int column_size = w->column_size;
+    if (column_size > 0) {
+        // if we fell behind by more than the widget is wide the older columns
+        // would scroll out right away, so skip them
+        size_t end = ringbuf_write_pos (&engine.columns);
+        size_t backlog = MIN (engine.columns.size, (size_t)width * column_size);
+        if (end - w->columns_pos > backlog) {
+            w->columns_pos = end - backlog;
+        }
+        while (!res && w->columns_pos + column_size <= end) {
+            w->columns_pos += column_size;
+            res = ringbuf_read (&engine.columns, w->data, w->columns_pos, column_size) == 0;
         }
     }
-    deadbeef->mutex_unlock (w->mutex);
-    if (w->buffered < FFT_SIZE) {
-        w->buffered += sz;
+    deadbeef->mutex_unlock (engine.mutex);
+    if (reset) {
+        // the old columns don't fit anymore
+        spectrogram_history_reset (w);
     }
+    return res;
 }
 
-static inline float
-spectrogram_get_value (gpointer user_data, int start, int end)
+static void
+spectrogram_cache_dir (char *dir, size_t size)
 {
-    w_spectrogram_t *w = user_data;
-    if (start >= end) {
-        return w->data[end];
+    snprintf (dir, size, "%s/spectrogram_cache", deadbeef->get_config_dir ());
+}
+
+static cache_key_t
+spectrogram_offline_key (w_spectrogram_t *w)
+{
+    cache_key_t key = {
+        .path = w->offline_path,
+        .mtime = w->offline_mtime,
+        .fft_size = w->offline_fft_size,
+        .hop = OFFLINE_HOP_SIZE,
+    };
+    return key;
+}
+
+// remember the cache key of the track, only local files can be cached
+static void
+spectrogram_offline_track (w_spectrogram_t *w, DB_playItem_t *it)
+{
+    w->offline_path[0] = 0;
+    deadbeef->pl_lock ();
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    struct stat st;
+    if (uri && strlen (uri) < sizeof (w->offline_path) && stat (uri, &st) == 0 && S_ISREG (st.st_mode)) {
+        strcpy (w->offline_path, uri);
+        w->offline_mtime = st.st_mtime;
+    }
+    deadbeef->pl_unlock ();
+}
+
+// whole track mode analyses every track, live mode only the ones that go
+// to the cache
+static int
+spectrogram_offline_job_wanted (w_spectrogram_t *w)
+{
+    return CONFIG_WHOLE_TRACK || (w->offline_path[0] && CONFIG_CACHE_MB > 0);
+}
+
+static void
+spectrogram_offline_store (w_spectrogram_t *w);
+
+// (re)start the whole track analysis of the playing track. Tracks seen
+// before are taken from the cache instead.
+static void
+spectrogram_offline_restart (w_spectrogram_t *w)
+{
+    // a job that finished in the meantime isn't wasted
+    spectrogram_offline_store (w);
+    if (w->offline) {
+        offline_job_free (w->offline);
+        w->offline = NULL;
     }
-    float value = 0.0;
-    for (int i = start; i < end; i++) {
-        value = MAX (w->data[i],value);
+    if (w->offline_cache) {
+        cache_close (w->offline_cache);
+        w->offline_cache = NULL;
     }
-    return value;
+    w->offline_fft_size = MIN (CONFIG_FFT_SIZE, MAX_OFFLINE_FFT_SIZE);
+    w->offline_stored = 0;
+    w->offline_stale = 1;
+
+    DB_playItem_t *it = deadbeef->streamer_get_playing_track ();
+    if (!it) {
+        w->offline_path[0] = 0;
+        return;
+    }
+    spectrogram_offline_track (w, it);
+    if (w->offline_path[0] && CONFIG_CACHE_MB > 0) {
+        char dir[PATH_MAX];
+        spectrogram_cache_dir (dir, sizeof (dir));
+        cache_key_t key = spectrogram_offline_key (w);
+        w->offline_cache = cache_open (dir, &key);
+    }
+    if (!w->offline_cache && spectrogram_offline_job_wanted (w)) {
+        w->offline = offline_job_start (deadbeef, it, w->offline_fft_size, OFFLINE_HOP_SIZE);
+    }
+    deadbeef->pl_item_unref (it);
 }
 
-static inline float
-linear_interpolate (float y1, float y2, float mu)
+// put the finished job's columns into the cache, once
+static void
+spectrogram_offline_store (w_spectrogram_t *w)
 {
-       return (y1 * (1 - mu) + y2 * mu);
+    if (w->offline_stored || !w->offline || !offline_job_finished (w->offline)) {
+        return;
+    }
+    w->offline_stored = 1;
+    const uint8_t *data = offline_job_data (w->offline);
+    if (!w->offline_path[0] || CONFIG_CACHE_MB <= 0 || !data) {
+        return;
+    }
+    char dir[PATH_MAX];
+    spectrogram_cache_dir (dir, sizeof (dir));
+    cache_key_t key = spectrogram_offline_key (w);
+    if (cache_store (dir, &key, offline_job_samplerate (w->offline), offline_job_columns (w->offline), data) == 0) {
+        cache_evict (dir, (int64_t)CONFIG_CACHE_MB << 20);
+    }
 }
 
-static gboolean
-spectrogram_draw (GtkWidget *widget, cairo_t *cr, gpointer user_data) {
-    w_spectrogram_t *w = user_data;
-    GtkAllocation a;
-    gtk_widget_get_allocation (widget, &a);
-    if (!w->samples || a.height < 1) {
-        return FALSE;
+// columns of the whole track, 0 while the job doesn't know yet
+static int
+spectrogram_offline_columns (w_spectrogram_t *w)
+{
+    if (w->offline_cache) {
+        return cache_columns (w->offline_cache);
     }
+    return w->offline ? offline_job_columns (w->offline) : 0;
+}
 
-    int width, height;
-    width = a.width;
-    height = a.height;
-    int ratio = ftoi (FFT_SIZE/(a.height*2));
-    ratio = CLAMP (ratio,0,1023);
-
-    if (deadbeef->get_output ()->state () == OUTPUT_STATE_PLAYING) {
-        do_fft (w);
-        float log_scale = (log2f(w->samplerate/2)-log2f(25.))/(a.height);
-        float freq_res = w->samplerate / FFT_SIZE;
-
-        if (a.height != w->height) {
-            w->height = MIN (a.height, MAX_HEIGHT);
-            for (int i = 0; i < w->height; i++) {
-                w->log_index[i] = ftoi (powf(2.,((float)i) * log_scale + log2f(25.)) / freq_res);
-                if (i > 0 && w->log_index[i-1] == w->log_index [i]) {
-                    w->low_res_end = i;
-                }
+// quantised column c of the whole track from the job or the cache, NULL
+// if it isn't done yet
+static const uint8_t *
+spectrogram_offline_column (w_spectrogram_t *w, int c)
+{
+    if (w->offline_cache) {
+        return cache_column (w->offline_cache, c);
+    }
+    return w->offline ? offline_job_column (w->offline, c) : NULL;
+}
+
+// pixel column x of the image into w->data: the peak of the columns it
+// covers, or the nearest one if there are fewer columns than pixels. -1
+// unless they are all done.
+static int
+spectrogram_offline_pixel (w_spectrogram_t *w, int x)
+{
+    int columns = spectrogram_offline_columns (w);
+    int c0 = (int)((int64_t)x * columns / w->offline_width);
+    int c1 = MAX ((int)((int64_t)(x + 1) * columns / w->offline_width), c0 + 1);
+    int bins = w->offline_fft_size/2;
+    uint8_t peak[MAX_OFFLINE_FFT_SIZE/2];
+    for (int c = c0; c < c1; c++) {
+        const uint8_t *column = spectrogram_offline_column (w, c);
+        if (!column) {
+            return -1;
+        }
+        // the quantisation keeps the order, the peak of the bytes is
+        // the peak of the powers
+        if (c == c0) {
+            memcpy (peak, column, bins);
+        }
+        else {
+            for (int i = 0; i < bins; i++) {
+                peak[i] = MAX (peak[i], column[i]);
+            }
+        }
+    }
+    history_dequantize (w->data, peak, bins);
+    return 0;
+}
+
+// the whole track columns of the playing track, in either mode. Restarts
+// wait until the requests settle, every request postpones them, e.g. while
+// skipping through tracks. A finished job goes to the cache.
+static void
+spectrogram_offline_update (w_spectrogram_t *w, gint64 now)
+{
+    if (__atomic_exchange_n (&w->offline_restart, 0, __ATOMIC_RELAXED)
+            || (!w->offline_restart_at && w->offline_fft_size != MIN (CONFIG_FFT_SIZE, MAX_OFFLINE_FFT_SIZE))) {
+        w->offline_restart_at = now + OFFLINE_SETTLE_TIME;
+    }
+    if (w->offline_restart_at && now >= w->offline_restart_at) {
+        w->offline_restart_at = 0;
+        spectrogram_offline_restart (w);
+    }
+    if (w->offline && !spectrogram_offline_job_wanted (w)) {
+        // back in live mode with a track that isn't cached
+        offline_job_free (w->offline);
+        w->offline = NULL;
+    }
+    spectrogram_offline_store (w);
+}
+
+// whole track mode: draw the pixel columns whose columns were finished
+// since the last frame into offline_surf and show it
+static void
+spectrogram_draw_offline (w_spectrogram_t *w, cairo_t *cr, int width, int height)
+{
+    gint64 now = g_get_monotonic_time ();
+    // before drawing, a finished job has all its columns drawn below then
+    spectrogram_offline_update (w, now);
+    if (width != w->offline_size_width || height != w->offline_size_height) {
+        w->offline_size_width = width;
+        w->offline_size_height = height;
+        w->offline_resize_at = now + OFFLINE_SETTLE_TIME;
+    }
+    if (w->offline_surf && w->offline_resize_at && now < w->offline_resize_at) {
+        // while the size keeps changing the old image is stretched to fit
+        int surf_width = cairo_image_surface_get_width (w->offline_surf);
+        int surf_height = cairo_image_surface_get_height (w->offline_surf);
+        PROFILE_BEGIN (PROFILE_PAINT);
+        cairo_save (cr);
+        cairo_scale (cr, (double)width / surf_width, (double)height / surf_height);
+        cairo_set_source_surface (cr, w->offline_surf, 0, 0);
+        cairo_paint (cr);
+        cairo_restore (cr);
+        PROFILE_END (PROFILE_PAINT);
+        return;
+    }
+    w->offline_resize_at = 0;
+    if (!w->offline_surf || cairo_image_surface_get_width (w->offline_surf) != width || cairo_image_surface_get_height (w->offline_surf) != height) {
+        // only the image is redone, the columns stay as they are
+        if (w->offline_surf) {
+            cairo_surface_destroy (w->offline_surf);
+        }
+        free (w->offline_drawn);
+        w->offline_surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+        w->offline_drawn = calloc (width, sizeof (uint8_t));
+        w->offline_width = w->offline_drawn ? width : 0;
+        w->offline_stale = 1;
+    }
+
+    cairo_surface_flush (w->offline_surf);
+    uint8_t *data = cairo_image_surface_get_data (w->offline_surf);
+    if (!data) {
+        return;
+    }
+    int stride = cairo_image_surface_get_stride (w->offline_surf);
+
+    int stale = __atomic_exchange_n (&w->offline_stale, 0, __ATOMIC_RELAXED);
+    if (w->offline || w->offline_cache) {
+        // the job's is only known once its first worker opened the track,
+        // it has no columns before that
+        float samplerate = w->offline_cache ? cache_samplerate (w->offline_cache) : offline_job_samplerate (w->offline);
+        if (samplerate > 0) {
+            stale |= raster_set_geometry (w->raster, height, w->offline_fft_size, samplerate, CONFIG_FREQ_SCALE);
+        }
+    }
+    if (stale) {
+        // columns that aren't done yet show silence
+        uint32_t background = raster_background (w->raster);
+        for (int y = 0; y < height; y++) {
+            uint32_t *row = (uint32_t *)(data + y * stride);
+            for (int x = 0; x < width; x++) {
+                row[x] = background;
+            }
+        }
+        if (w->offline_drawn) {
+            memset (w->offline_drawn, 0, w->offline_width);
+        }
+    }
+
+    if (spectrogram_offline_columns (w) > 0) {
+        uint32_t *bottom = (uint32_t *)(data + (raster_height (w->raster) - 1) * stride);
+        for (int x = 0; x < w->offline_width; x++) {
+            if (!w->offline_drawn[x] && spectrogram_offline_pixel (w, x) == 0) {
+                PROFILE_BEGIN (PROFILE_RENDER);
+                raster_render_column (w->raster, w->data, bottom + x, -stride/4);
+                PROFILE_END (PROFILE_RENDER);
+                w->offline_drawn[x] = 1;
             }
         }
     }
+    cairo_surface_mark_dirty (w->offline_surf);
+
+    PROFILE_BEGIN (PROFILE_PAINT);
+    cairo_save (cr);
+    cairo_set_source_surface (cr, w->offline_surf, 0, 0);
+    cairo_rectangle (cr, 0, 0, width, height);
+    cairo_fill (cr);
+    cairo_restore (cr);
+    PROFILE_END (PROFILE_PAINT);
+}
+
+static int
+spectrogram_live_geometry (w_spectrogram_t *w, int height)
+{
+    if (w->cqt_bins > 0) {
+        return raster_set_cqt_geometry (w->raster, height / MAX (w->lanes, 1), w->cqt_bins);
+    }
+    return raster_set_geometry (w->raster, height / MAX (w->lanes, 1), w->fft_size, engine.samplerate, CONFIG_FREQ_SCALE);
+}
+
+// start surf over with the newest columns of the history that fit, the
+// rest shows silence
+static void
+spectrogram_draw_history (w_spectrogram_t *w, uint8_t *data, int stride, int width, int height)
+{
+    uint32_t background = raster_background (w->raster);
+    for (int y = 0; y < height; y++) {
+        uint32_t *row = (uint32_t *)(data + y * stride);
+        for (int x = 0; x < width; x++) {
+            row[x] = background;
+        }
+    }
+    w->cursor = 0;
+    if (!w->history) {
+        return;
+    }
+    int count = history_count (w->history);
+    for (int i = MAX (count - width, 0); i < count; i++) {
+        history_get (w->history, i, w->data);
+        spectrogram_draw_column (w, data, stride, width, height);
+    }
+}
+
+// after a seek: the history up to the new position from the whole track
+// columns, as far as the widget is wide, instead of what played before the
+// seek. Only if they fit the live columns: one lane of the same FFT size
+// and sample rate, no constant-Q. Columns that aren't done yet and the
+// time before the track show silence.
+static void
+spectrogram_live_seed (w_spectrogram_t *w, int width)
+{
+    int columns = spectrogram_offline_columns (w);
+    float samplerate = w->offline_cache ? cache_samplerate (w->offline_cache) : (w->offline ? offline_job_samplerate (w->offline) : 0);
+    if (!w->history || columns == 0 || w->lanes != 1 || w->cqt_bins || w->fft_size != w->offline_fft_size
+            || samplerate != engine.samplerate) {
+        return;
+    }
+    uint8_t silence[MAX_OFFLINE_FFT_SIZE/2] = {0};
+    int64_t pos = (int64_t)(deadbeef->streamer_get_playpos () * samplerate);
+    int n = MIN (width, history_capacity (w->history));
+    history_clear (w->history);
+    for (int i = n - 1; i >= 0; i--) {
+        // the live column i hops before the position
+        int64_t t = pos - (int64_t)i * CONFIG_HOP_SIZE;
+        const uint8_t *column = t >= 0 ? spectrogram_offline_column (w, (int)MIN (t / OFFLINE_HOP_SIZE, columns - 1)) : NULL;
+        history_push_quantized (w->history, column ? column : silence);
+    }
+    // the queued columns are from before the seek
+    deadbeef->mutex_lock (engine.mutex);
+    if (w->generation == engine.generation) {
+        w->columns_pos = ringbuf_write_pos (&engine.columns);
+    }
+    deadbeef->mutex_unlock (engine.mutex);
+    w->live_stale = 1;
+}
+
+// live mode: draw the queued columns into the ring surface and show it
+static void
+spectrogram_draw_live (w_spectrogram_t *w, cairo_t *cr, int width, int height)
+{
+    spectrogram_offline_update (w, g_get_monotonic_time ());
 
     // start drawing
-    if (!w->surf || cairo_image_surface_get_width (w->surf) != a.width || cairo_image_surface_get_height (w->surf) != a.height) {
+    if (!w->surf || cairo_image_surface_get_width (w->surf) != width || cairo_image_surface_get_height (w->surf) != height) {
         if (w->surf) {
             cairo_surface_destroy (w->surf);
             w->surf = NULL;
         }
-        w->surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24, a.width, a.height);
+        w->surf = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+        w->cursor = 0;
+        w->live_stale = 1;
+    }
+    if (w->history && history_capacity (w->history) != spectrogram_history_capacity (w)) {
+        // the limits or the hop size changed
+        spectrogram_history_reset (w);
     }
 
     cairo_surface_flush (w->surf);
 
     unsigned char *data = cairo_image_surface_get_data (w->surf);
     if (!data) {
-        return FALSE;
+        return;
     }
     int stride = cairo_image_surface_get_stride (w->surf);
 
-    if (deadbeef->get_output ()->state () == OUTPUT_STATE_PLAYING) {
-        for (int i = 0; i < a.height; i++) {
-            // scrolling: move line i 1px to the left
-            memmove (data + (i*stride), data + sizeof (uint32_t) + (i*stride), stride - sizeof (uint32_t));
-        }
-
-        for (int i = 0; i < a.height; i++)
-        {
-            float f = 1.0;
-            int index0, index1;
-            int bin0, bin1, bin2;
-            if (CONFIG_LOG_SCALE) {
-                bin0 = w->log_index[CLAMP (i-1,0,height-1)];
-                bin1 = w->log_index[i];
-                bin2 = w->log_index[CLAMP (i+1,0,height-1)];
-            }
-            else {
-                bin0 = (i-1) * ratio;
-                bin1 = i * ratio;
-                bin2 = (i+1) * ratio;
-            }
-
-            index0 = bin0 + ftoi ((bin1 - bin0)/2.f);
-            if (index0 == bin0) index0 = bin1;
-            index1 = bin1 + ftoi ((bin2 - bin1)/2.f);
-            if (index1 == bin2) index1 = bin1;
-
-            index0 = CLAMP (index0,0,FFT_SIZE/2-1);
-            index1 = CLAMP (index1,0,FFT_SIZE/2-1);
-
-            f = spectrogram_get_value (w, index0, index1);
-            float x = 10 * log10f (f);
-
-            // interpolate
-            if (i <= w->low_res_end && CONFIG_LOG_SCALE) {
-                int j = 0;
-                // find index of next value
-                while (i+j < height && w->log_index[i+j] == w->log_index[i]) {
-                    j++;
-                }
-                float v0 = x;
-                float v1 = w->data[w->log_index[i+j]];
-                if (v1 != 0) {
-                    v1 = 10 * log10f (v1);
-                }
-
-                int k = 0;
-                while ((k+i) >= 0 && w->log_index[k+i] == w->log_index[i]) {
-                    j++;
-                    k--;
-                }
-                x = linear_interpolate (v0,v1,(1.0/(j-1)) * ((-1 * k) - 1));
-            }
+    // not before the columns are the ones of the track that is playing
+    if (!w->offline_restart_at && __atomic_exchange_n (&w->live_seek, 0, __ATOMIC_RELAXED)) {
+        spectrogram_live_seed (w, width);
+    }
+    int stale = __atomic_exchange_n (&w->live_stale, 0, __ATOMIC_RELAXED);
+    if (w->fft_size > 0) {
+        stale |= spectrogram_live_geometry (w, height);
+    }
+    if (stale) {
+        spectrogram_draw_history (w, data, stride, width, height);
+    }
 
-            // TODO: get rid of hardcoding 
-            x += CONFIG_DB_RANGE - 63;
-            x = CLAMP (x, 0, CONFIG_DB_RANGE);
-            int color_index = GRADIENT_TABLE_SIZE - ftoi (GRADIENT_TABLE_SIZE/(float)CONFIG_DB_RANGE * x);
-            color_index = CLAMP (color_index, 0, GRADIENT_TABLE_SIZE-1);
-            _draw_point (data, stride, width-1, height-1-i, w->colors[color_index]);
+    // draw everything the analysis thread finished since the last frame
+    while (spectrogram_next_column (w, width)) {
+        if (w->history) {
+            history_push (w->history, w->data);
+        }
+        PROFILE_BEGIN (PROFILE_RENDER);
+        if (spectrogram_live_geometry (w, height)) {
+            // the new column is the last one of the history
+            spectrogram_draw_history (w, data, stride, width, height);
         }
+        else {
+            spectrogram_draw_column (w, data, stride, width, height);
+        }
+        PROFILE_END (PROFILE_RENDER);
     }
     cairo_surface_mark_dirty (w->surf);
 
+    // the column under the cursor is the oldest one, so everything from
+    // there to the end of the surface goes to the left edge of the widget
+    // and the wrapped-around part follows it
+    PROFILE_BEGIN (PROFILE_PAINT);
+    int split = width - w->cursor;
     cairo_save (cr);
-    cairo_set_source_surface (cr, w->surf, 0, 0);
-    cairo_rectangle (cr, 0, 0, a.width, a.height);
+    cairo_set_source_surface (cr, w->surf, -w->cursor, 0);
+    cairo_rectangle (cr, 0, 0, split, height);
     cairo_fill (cr);
+    if (w->cursor > 0) {
+        cairo_set_source_surface (cr, w->surf, split, 0);
+        cairo_rectangle (cr, split, 0, w->cursor, height);
+        cairo_fill (cr);
+    }
     cairo_restore (cr);
+    PROFILE_END (PROFILE_PAINT);
+}
+
+#ifdef ENABLE_PROFILING
+// timing overlay in the top left corner
+static void
+spectrogram_draw_stats (cairo_t *cr)
+{
+    char line[100];
+    cairo_save (cr);
+    cairo_set_source_rgba (cr, 0, 0, 0, 0.6);
+    cairo_rectangle (cr, 4, 4, 320, 14 * (PROFILE_STAGES + 1) + 8);
+    cairo_fill (cr);
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    cairo_select_font_face (cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size (cr, 11);
+    cairo_move_to (cr, 10, 18);
+    cairo_show_text (cr, "stage       n/s    min    avg    p99  (us)");
+    for (int i = 0; i < PROFILE_STAGES; i++) {
+        profile_stats_t st;
+        profile_get (i, &st);
+        snprintf (line, sizeof (line), "%-8s %6llu %6.1f %6.1f %6.1f", profile_stage_name (i),
+                (unsigned long long)st.count, st.min/1000, st.avg/1000, st.p99/1000);
+        cairo_move_to (cr, 10, 18 + 14 * (i + 1));
+        cairo_show_text (cr, line);
+    }
+    cairo_restore (cr);
+}
+#endif
+
+static gboolean
+spectrogram_draw (GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+    w_spectrogram_t *w = user_data;
+    GtkAllocation a;
+    gtk_widget_get_allocation (widget, &a);
+    if (a.height < 1) {
+        return FALSE;
+    }
 
+    int width, height;
+    width = a.width;
+    height = a.height;
+
+    if (__atomic_exchange_n (&w->recolor, 0, __ATOMIC_RELAXED)) {
+        spectrogram_apply_colors (w);
+        w->offline_stale = 1;
+        w->live_stale = 1;
+    }
+    if (CONFIG_WHOLE_TRACK) {
+        spectrogram_draw_offline (w, cr, width, height);
+    }
+    else {
+        spectrogram_draw_live (w, cr, width, height);
+    }
+#ifdef ENABLE_PROFILING
+    if (w->show_stats) {
+        spectrogram_draw_stats (cr);
+    }
+#endif
     return FALSE;
 }
 
@@ -800,19 +1841,18 @@ spectrogram_button_release_event (GtkWidget *widget, GdkEventButton *event, gpoi
     return TRUE;
 }
 
+// messages arrive in whatever thread sent them
 static gboolean
-spectrogram_set_refresh_interval (gpointer user_data, int interval)
+spectrogram_wake_cb (gpointer user_data)
 {
     w_spectrogram_t *w = user_data;
-    if (!w || interval <= 0) {
-        return FALSE;
-    }
-    if (w->drawtimer) {
-        g_source_remove (w->drawtimer);
-        w->drawtimer = 0;
+    for (w_spectrogram_t *it = widgets; it; it = it->next) {
+        // unless it's gone by now
+        if (it == w) {
+            spectrogram_wake (w);
+        }
     }
-    w->drawtimer = g_timeout_add (interval, w_spectrogram_draw_cb, w);
-    return TRUE;
+    return FALSE;
 }
 
 static int
@@ -823,27 +1863,16 @@ spectrogram_message (ddb_gtkui_widget_t *widget, uint32_t id, uintptr_t ctx, uin
     switch (id) {
         case DB_EV_CONFIGCHANGED:
             on_config_changed (w, ctx);
-            spectrogram_set_refresh_interval (w, CONFIG_REFRESH_INTERVAL);
+            g_idle_add (spectrogram_wake_cb, w);
             break;
         case DB_EV_SONGSTARTED:
-            spectrogram_set_refresh_interval (w, CONFIG_REFRESH_INTERVAL);
-            break;
-        case DB_EV_PAUSED:
-            if (deadbeef->get_output ()->state () == OUTPUT_STATE_PLAYING) {
-                spectrogram_set_refresh_interval (w, CONFIG_REFRESH_INTERVAL);
-            }
-            else {
-                if (w->drawtimer) {
-                    g_source_remove (w->drawtimer);
-                    w->drawtimer = 0;
-                }
-            }
+            // picked up with the next frame, that runs in the GTK thread
+            __atomic_store_n (&w->offline_restart, 1, __ATOMIC_RELAXED);
+            g_idle_add (spectrogram_wake_cb, w);
             break;
-        case DB_EV_STOP:
-            if (w->drawtimer) {
-                g_source_remove (w->drawtimer);
-                w->drawtimer = 0;
-            }
+        case DB_EV_SEEKED:
+            __atomic_store_n (&w->live_seek, 1, __ATOMIC_RELAXED);
+            g_idle_add (spectrogram_wake_cb, w);
             break;
     }
     return 0;
@@ -853,38 +1882,105 @@ void
 w_spectrogram_init (ddb_gtkui_widget_t *w) {
     w_spectrogram_t *s = (w_spectrogram_t *)w;
     load_config ();
-    deadbeef->mutex_lock (s->mutex);
-    s->samples = malloc (sizeof (double) * FFT_SIZE);
-    memset (s->samples, 0, sizeof (double) * FFT_SIZE);
-    s->data = malloc (sizeof (double) * FFT_SIZE);
-    memset (s->data, 0, sizeof (double) * FFT_SIZE);
-    if (s->drawtimer) {
-        g_source_remove (s->drawtimer);
-        s->drawtimer = 0;
-    }
-    s->samplerate = 44100.0;
-    s->height = 0;
-    s->low_res_end = 0;
-    s->log_index = (int *)malloc (sizeof (int) * MAX_HEIGHT);
-    memset (s->log_index, 0, sizeof (int) * MAX_HEIGHT);
-
-    for (int i = 0; i < FFT_SIZE; i++) {
-        // Hanning
-        //s->window[i] = (0.5 * (1 - cos (2 * M_PI * i/(FFT_SIZE-1))));
-        // Blackman-Harris
-        s->window[i] = 0.35875 - 0.48829 * cos(2 * M_PI * i /(FFT_SIZE)) + 0.14128 * cos(4 * M_PI * i/(FFT_SIZE)) - 0.01168 * cos(6 * M_PI * i/(FFT_SIZE));;
-    }
-    create_gradient_table (s, CONFIG_GRADIENT_COLORS, CONFIG_NUM_COLORS);
-    s->in = fftw_malloc (sizeof (double) * FFT_SIZE);
-    memset (s->in, 0, sizeof (double) * FFT_SIZE);
-    //s->out_real = fftw_malloc (sizeof (double) * FFT_SIZE);
-    s->out_complex = fftw_malloc (sizeof (fftw_complex) * FFT_SIZE);
-    //s->p_r2r = fftw_plan_r2r_1d (FFT_SIZE, s->in, s->out_real, FFTW_R2HC, FFTW_ESTIMATE);
-    s->p_r2c = fftw_plan_dft_r2c_1d (FFT_SIZE, s->in, s->out_complex, FFTW_ESTIMATE);
-    spectrogram_set_refresh_interval (s, CONFIG_REFRESH_INTERVAL);
-    deadbeef->mutex_unlock (s->mutex);
+    // picks up the engine's FFT size and queue position with the first frame
+    s->generation = -1;
+    s->data = simd_malloc (sizeof (sample_t) * MAX_FFT_SIZE/2 * STFT_MAX_LANES);
+    memset (s->data, 0, sizeof (sample_t) * MAX_FFT_SIZE/2 * STFT_MAX_LANES);
+    s->raster = raster_new ();
+
+    spectrogram_apply_colors (s);
+    spectrogram_wake (s);
+}
+
+static void
+on_whole_track_toggled (GtkCheckMenuItem *item, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    CONFIG_WHOLE_TRACK = gtk_check_menu_item_get_active (item);
+    deadbeef->conf_set_int (CONFSTR_SP_WHOLE_TRACK, CONFIG_WHOLE_TRACK);
+    // start over with the track that is playing now, or show the live
+    // view's history
+    __atomic_store_n (&w->offline_restart, 1, __ATOMIC_RELAXED);
+    w->live_stale = 1;
+    spectrogram_wake (w);
 }
 
+static void
+spectrogram_update_active (w_spectrogram_t *w)
+{
+    spectrogram_set_active (w, w->mapped && !w->hidden);
+}
+
+static void
+spectrogram_map (GtkWidget *widget, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    w->mapped = 1;
+    spectrogram_update_active (w);
+}
+
+static void
+spectrogram_unmap (GtkWidget *widget, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    w->mapped = 0;
+    spectrogram_update_active (w);
+}
+
+#if !GTK_CHECK_VERSION(3,0,0)
+static gboolean
+spectrogram_visibility_notify_event (GtkWidget *widget, GdkEventVisibility *event, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    w->hidden = event->state == GDK_VISIBILITY_FULLY_OBSCURED;
+    spectrogram_update_active (w);
+    return FALSE;
+}
+#else
+// GTK3 has no visibility events, but a minimised window stays mapped, so
+// follow the state of the toplevel window instead
+#define HIDDEN_WINDOW_STATE (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)
+
+static gboolean
+spectrogram_window_state_event (GtkWidget *widget, GdkEventWindowState *event, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    w->hidden = (event->new_window_state & HIDDEN_WINDOW_STATE) != 0;
+    spectrogram_update_active (w);
+    return FALSE;
+}
+
+// the widget moved to another window, e.g. in the layout editor
+static void
+spectrogram_hierarchy_changed (GtkWidget *widget, GtkWidget *previous_toplevel, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    if (previous_toplevel) {
+        g_signal_handlers_disconnect_by_func (previous_toplevel, spectrogram_window_state_event, w);
+    }
+    GtkWidget *toplevel = gtk_widget_get_toplevel (widget);
+    GdkWindow *window = NULL;
+    w->hidden = 0;
+    if (gtk_widget_is_toplevel (toplevel)) {
+        g_signal_connect (toplevel, "window-state-event", G_CALLBACK (spectrogram_window_state_event), w);
+        window = gtk_widget_get_window (toplevel);
+    }
+    if (window) {
+        w->hidden = (gdk_window_get_state (window) & HIDDEN_WINDOW_STATE) != 0;
+    }
+    spectrogram_update_active (w);
+}
+#endif
+
+#ifdef ENABLE_PROFILING
+static void
+on_stats_toggled (GtkCheckMenuItem *item, gpointer user_data)
+{
+    w_spectrogram_t *w = user_data;
+    w->show_stats = gtk_check_menu_item_get_active (item);
+}
+#endif
+
 ddb_gtkui_widget_t *
 w_spectrogram_create (void) {
     w_spectrogram_t *w = malloc (sizeof (w_spectrogram_t));
@@ -897,23 +1993,42 @@ w_spectrogram_create (void) {
     w->drawarea = gtk_drawing_area_new ();
     w->popup = gtk_menu_new ();
     w->popup_item = gtk_menu_item_new_with_mnemonic ("Configure");
-    w->mutex = deadbeef->mutex_create ();
+    w->whole_track_item = gtk_check_menu_item_new_with_mnemonic ("Whole track");
     gtk_widget_show (w->drawarea);
     gtk_container_add (GTK_CONTAINER (w->base.widget), w->drawarea);
     gtk_widget_show (w->popup);
     //gtk_container_add (GTK_CONTAINER (w->drawarea), w->popup);
     gtk_widget_show (w->popup_item);
     gtk_container_add (GTK_CONTAINER (w->popup), w->popup_item);
+    gtk_check_menu_item_set_active (GTK_CHECK_MENU_ITEM (w->whole_track_item), deadbeef->conf_get_int (CONFSTR_SP_WHOLE_TRACK, 0));
+    gtk_widget_show (w->whole_track_item);
+    gtk_container_add (GTK_CONTAINER (w->popup), w->whole_track_item);
+#ifdef ENABLE_PROFILING
+    w->stats_item = gtk_check_menu_item_new_with_mnemonic ("Timing stats");
+    gtk_widget_show (w->stats_item);
+    gtk_container_add (GTK_CONTAINER (w->popup), w->stats_item);
+#endif
 #if !GTK_CHECK_VERSION(3,0,0)
     g_signal_connect_after ((gpointer) w->drawarea, "expose_event", G_CALLBACK (spectrogram_expose_event), w);
+    gtk_widget_add_events (w->drawarea, GDK_VISIBILITY_NOTIFY_MASK);
+    g_signal_connect_after ((gpointer) w->drawarea, "visibility_notify_event", G_CALLBACK (spectrogram_visibility_notify_event), w);
 #else
     g_signal_connect_after ((gpointer) w->drawarea, "draw", G_CALLBACK (spectrogram_draw), w);
+    g_signal_connect_after ((gpointer) w->drawarea, "hierarchy-changed", G_CALLBACK (spectrogram_hierarchy_changed), w);
 #endif
+    g_signal_connect_after ((gpointer) w->drawarea, "map", G_CALLBACK (spectrogram_map), w);
+    g_signal_connect_after ((gpointer) w->drawarea, "unmap", G_CALLBACK (spectrogram_unmap), w);
     g_signal_connect_after ((gpointer) w->base.widget, "button_press_event", G_CALLBACK (spectrogram_button_press_event), w);
     g_signal_connect_after ((gpointer) w->base.widget, "button_release_event", G_CALLBACK (spectrogram_button_release_event), w);
     g_signal_connect_after ((gpointer) w->popup_item, "activate", G_CALLBACK (on_button_config), w);
+    g_signal_connect_after ((gpointer) w->whole_track_item, "toggled", G_CALLBACK (on_whole_track_toggled), w);
+#ifdef ENABLE_PROFILING
+    g_signal_connect_after ((gpointer) w->stats_item, "toggled", G_CALLBACK (on_stats_toggled), w);
+#endif
     gtkui_plugin->w_override_signals (w->base.widget, w);
-    deadbeef->vis_waveform_listen (w, spectrogram_wavedata_listener);
+    // the engine only runs while the widget is mapped
+    w->next = widgets;
+    widgets = w;
     return (ddb_gtkui_widget_t *)w;
 }
 
@@ -937,6 +2052,10 @@ int
 spectrogram_start (void)
 {
     load_config ();
+    kernels_init ();
+    fft_set_wisdom_file (deadbeef->get_config_dir ());
+    engine.mutex = deadbeef->mutex_create ();
+    engine.cond = deadbeef->cond_create ();
     return 0;
 }
 
@@ -944,6 +2063,14 @@ int
 spectrogram_stop (void)
 {
     save_config ();
+    if (engine.cond) {
+        deadbeef->cond_free (engine.cond);
+        engine.cond = 0;
+    }
+    if (engine.mutex) {
+        deadbeef->mutex_free (engine.mutex);
+        engine.mutex = 0;
+    }
     return 0;
 }
 
@@ -966,7 +2093,23 @@ spectrogram_disconnect (void)
 }
 
 static const char settings_dlg[] =
+#if !GTK_CHECK_VERSION(3,8,0)
+    // with a frame clock redraws follow the display instead
     "property \"Refresh interval (ms): \"          spinbtn[10,1000,1] "      CONFSTR_SP_REFRESH_INTERVAL        " 25 ;\n"
+#endif
+    "property \"Exhaustive FFT planning (slow first start): \" checkbox "  CONFSTR_SP_FFT_PATIENT             " 0 ;\n"
+    "property \"Scrollback (minutes): \"           spinbtn[0,60,1] "        CONFSTR_SP_HISTORY_MINUTES         " 5 ;\n"
+    "property \"Scrollback memory limit (MB): \"   spinbtn[1,1024,1] "      CONFSTR_SP_HISTORY_MB              " 64 ;\n"
+    "property \"Whole track cache size (MB, 0 = off): \" spinbtn[0,16384,16] " CONFSTR_SP_CACHE_MB              " 256 ;\n"
+    "property \"Constant-Q bins per octave (0 = FFT bins): \" spinbtn[0,96,1] " CONFSTR_SP_CQT_BINS_PER_OCTAVE " 0 ;\n"
+    "property \"Multi-resolution (FFT size for the bass, smaller above): \" checkbox " CONFSTR_SP_MULTIRES " 0 ;\n"
+    "property \"Multi-resolution low crossover (Hz): \" spinbtn[50,20000,10] " CONFSTR_SP_CROSSOVER_LOW " 500 ;\n"
+    "property \"Multi-resolution high crossover (Hz): \" spinbtn[50,20000,10] " CONFSTR_SP_CROSSOVER_HIGH " 4000 ;\n"
+    "property \"Lowest frequency shown (Hz): \"    spinbtn[0,96000,10] "    CONFSTR_SP_MIN_FREQ                " 0 ;\n"
+    "property \"Highest frequency shown (Hz, 0 = all): \" spinbtn[0,96000,10] " CONFSTR_SP_MAX_FREQ          " 0 ;\n"
+#ifdef ENABLE_PROFILING
+    "property \"Log timing stats to spectrogram_profile.log: \" checkbox " CONFSTR_SP_PROFILE_LOG             " 0 ;\n"
+#endif
 ;
 
 static DB_misc_t plugin = {
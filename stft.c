@@ -0,0 +1,554 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef CLAMP
+#define CLAMP(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+#endif
+
+#include "stft.h"
+
+// one band of the multi-resolution mode
+typedef struct {
+    // transform length, decimation factor and the FFT size of the resolution
+    // (size * factor)
+    int size;
+    int factor;
+    int resolution;
+    // column bins [lo,hi) taken from this band and the power scale that
+    // brings it to the level of the full size FFT
+    int lo;
+    int hi;
+    sample_t scale;
+    // decimated bands: the filter and the last size decimated samples of
+    // every lane, up to input position history_end
+    decimator_t *decimator;
+    sample_t *history;
+    size_t history_end;
+    int history_valid;
+    sample_t *window;
+    sample_t *in;
+    FFTW(complex) *out;
+    FFTW(plan) plan;
+} stft_band_t;
+
+struct stft_s {
+    // written by the producer, one ring per lane. All rings are allocated up
+    // front and kept at the same position, only the first input_lanes of
+    // them are written.
+    ringbuf_t ring[STFT_MAX_LANES];
+    int input_lanes;
+    // everything below belongs to the consumer
+    size_t analysis_pos;
+    int fft_size;
+    int lanes;
+    // planner flags of stft_configure, also used for the band plans
+    unsigned plan_flags;
+    sample_t *window;
+    sample_t *in;
+    FFTW(complex) *out;
+    FFTW(plan) plan;
+    // constant-Q mode: kernels for fft_size, frames aren't windowed
+    cqt_t *cqt;
+    // multi-resolution mode, see stft_set_bands. The band windows are
+    // centred delay samples before the end of the hop, reach is how far
+    // back a transform reads.
+    stft_band_t band[STFT_MAX_BANDS];
+    int bands;
+    size_t delay;
+    size_t reach;
+    // decimator input and band power spectra
+    sample_t *scratch;
+    sample_t *power;
+};
+
+stft_t *
+stft_new (int max_fft_size)
+{
+    stft_t *s = calloc (1, sizeof (stft_t));
+    if (!s) {
+        return NULL;
+    }
+    for (int l = 0; l < STFT_MAX_LANES; l++) {
+        if (ringbuf_init (&s->ring[l], max_fft_size * 2) < 0) {
+            stft_free (s);
+            return NULL;
+        }
+    }
+    s->input_lanes = 1;
+    return s;
+}
+
+static void
+stft_free_bands (stft_t *s)
+{
+    for (int i = 0; i < s->bands; i++) {
+        stft_band_t *b = &s->band[i];
+        if (b->plan) {
+            fft_destroy_plan (b->plan);
+        }
+        if (b->decimator) {
+            decimator_free (b->decimator);
+        }
+        free (b->history);
+        free (b->window);
+        free (b->in);
+        free (b->out);
+    }
+    memset (s->band, 0, sizeof (s->band));
+    s->bands = 0;
+    free (s->scratch);
+    free (s->power);
+    s->scratch = NULL;
+    s->power = NULL;
+    s->delay = 0;
+    s->reach = s->fft_size;
+}
+
+static void
+stft_free_fft (stft_t *s)
+{
+    stft_free_bands (s);
+    if (s->plan) {
+        fft_destroy_plan (s->plan);
+        s->plan = NULL;
+    }
+    if (s->cqt) {
+        cqt_free (s->cqt);
+        s->cqt = NULL;
+    }
+    free (s->window);
+    free (s->in);
+    free (s->out);
+    s->window = NULL;
+    s->in = NULL;
+    s->out = NULL;
+}
+
+void
+stft_free (stft_t *s)
+{
+    stft_free_fft (s);
+    for (int l = 0; l < STFT_MAX_LANES; l++) {
+        ringbuf_free (&s->ring[l]);
+    }
+    free (s);
+}
+
+static int
+stft_mix_lanes (const stft_mix_t *mix, int channels)
+{
+    switch (mix->mode) {
+    case CHANNELS_SEPARATE:
+        return channels < 1 ? 1 : (channels > STFT_MAX_LANES ? STFT_MAX_LANES : channels);
+    case CHANNELS_MID_SIDE:
+        return channels >= 2 ? 2 : 1;
+    default:
+        return 1;
+    }
+}
+
+void
+stft_push (stft_t *s, const float *pcm, int frames, int channels, const stft_mix_t *mix)
+{
+    // never hand the consumer more than it can catch up with
+    int sz = frames;
+    if ((size_t)sz > s->ring[0].size / 2) {
+        sz = s->ring[0].size / 2;
+    }
+    const float *in = pcm + (frames - sz) * channels;
+
+    int lanes = stft_mix_lanes (mix, channels);
+    __atomic_store_n (&s->input_lanes, lanes, __ATOMIC_RELAXED);
+
+    // lane 0 goes last, the consumer goes by its write position
+    for (int l = lanes - 1; l >= 0; l--) {
+        int downmix = DOWNMIX_CHANNEL;
+        int channel = l;
+        if (mix->mode == CHANNELS_MIX) {
+            downmix = mix->downmix;
+            channel = mix->channel;
+        }
+        else if (mix->mode == CHANNELS_MID_SIDE) {
+            downmix = l == 0 ? DOWNMIX_MID : DOWNMIX_SIDE;
+        }
+
+        ringbuf_t *rb = &s->ring[l];
+        if (l > 0) {
+            // catch up with lane 0 if this lane wasn't used for a while
+            ringbuf_skip_to (rb, s->ring[0].write_pos);
+        }
+        // straight into the ring, in two parts if it wraps
+        size_t start = ringbuf_write_begin (rb, sz);
+        size_t n1 = ringbuf_contiguous (rb, start);
+        if (n1 > (size_t)sz) {
+            n1 = sz;
+        }
+        kernels.downmix (ringbuf_slot (rb, start), in, n1, channels, downmix, channel);
+        kernels.downmix (ringbuf_slot (rb, start + n1), in + n1 * channels, sz - n1, channels, downmix, channel);
+        ringbuf_write_commit (rb, sz);
+    }
+}
+
+int
+stft_input_lanes (stft_t *s)
+{
+    return __atomic_load_n (&s->input_lanes, __ATOMIC_RELAXED);
+}
+
+int
+stft_configure (stft_t *s, int fft_size, int lanes, unsigned plan_flags)
+{
+    sample_t *window = simd_malloc (sizeof (sample_t) * fft_size);
+    sample_t *in = simd_malloc (sizeof (sample_t) * fft_size * lanes);
+    FFTW(complex) *out = simd_malloc (sizeof (FFTW(complex)) * (fft_size/2 + 1) * lanes);
+    // one batched plan for all lanes is considerably cheaper than a plan
+    // per lane
+    FFTW(plan) plan = NULL;
+    if (window && in && out) {
+        plan = fft_plan_many_r2c (fft_size, lanes, in, out, plan_flags);
+    }
+    if (!plan) {
+        free (window);
+        free (in);
+        free (out);
+        return -1;
+    }
+    // Hanning
+    //window[i] = (0.5 * (1 - cos (2 * M_PI * i/(fft_size-1))));
+    fft_window_blackman_harris (window, fft_size);
+
+    stft_free_fft (s);
+    s->window = window;
+    s->in = in;
+    s->out = out;
+    s->plan = plan;
+    s->fft_size = fft_size;
+    s->lanes = lanes;
+    s->plan_flags = plan_flags;
+    s->reach = fft_size;
+    return 0;
+}
+
+int
+stft_set_cqt (stft_t *s, float samplerate, int bins_per_octave)
+{
+    cqt_t *cqt = NULL;
+    if (bins_per_octave > 0) {
+        if (!s->plan || !(cqt = cqt_new (s->fft_size, samplerate, bins_per_octave))) {
+            return -1;
+        }
+    }
+    if (s->cqt) {
+        cqt_free (s->cqt);
+    }
+    s->cqt = cqt;
+    if (cqt) {
+        stft_free_bands (s);
+    }
+    return 0;
+}
+
+int
+stft_cqt_bins (stft_t *s)
+{
+    return s->cqt ? cqt_bins (s->cqt) : 0;
+}
+
+static int
+stft_band_init (stft_band_t *b, int lanes, unsigned plan_flags)
+{
+    int n = b->size;
+    b->window = simd_malloc (sizeof (sample_t) * n);
+    b->in = simd_malloc (sizeof (sample_t) * n * lanes);
+    b->out = simd_malloc (sizeof (FFTW(complex)) * (n/2 + 1) * lanes);
+    if (!b->window || !b->in || !b->out) {
+        return -1;
+    }
+    if (b->factor > 1) {
+        b->decimator = decimator_new (b->factor);
+        b->history = simd_malloc (sizeof (sample_t) * n * lanes);
+        if (!b->decimator || !b->history) {
+            return -1;
+        }
+    }
+    fft_window_blackman_harris (b->window, n);
+    b->plan = fft_plan_many_r2c (n, lanes, b->in, b->out, plan_flags);
+    return b->plan ? 0 : -1;
+}
+
+int
+stft_set_bands (stft_t *s, float samplerate, const float *crossovers, int num_crossovers, float max_freq)
+{
+    float limit = max_freq > 0 ? MIN (max_freq, samplerate/2) : samplerate/2;
+    // crossovers above the limit would only make empty bands
+    while (num_crossovers > 0 && crossovers[num_crossovers-1] >= limit) {
+        num_crossovers--;
+    }
+    // a single band is only worth it if it can be decimated
+    if (num_crossovers <= 0 && limit > DECIMATOR_PASSBAND * samplerate / 4) {
+        stft_free_bands (s);
+        return 0;
+    }
+    if (!s->plan) {
+        return -1;
+    }
+    int fft_size = s->fft_size;
+    int bins = fft_size/2;
+    stft_t tmp = { .fft_size = fft_size };
+    tmp.bands = MIN (num_crossovers + 1, STFT_MAX_BANDS);
+    size_t delay = 0;
+    size_t reach = 0;
+    int res = 0;
+    for (int i = 0; i < tmp.bands && res == 0; i++) {
+        stft_band_t *b = &tmp.band[i];
+        b->resolution = MAX (fft_size >> (2*i), STFT_MIN_BAND_SIZE);
+        b->lo = i > 0 ? tmp.band[i-1].hi : 0;
+        float top = i < tmp.bands - 1 ? CLAMP (crossovers[i], 0, limit) : limit;
+        b->hi = CLAMP ((int)ceilf (top * fft_size / samplerate), b->lo, bins);
+        // decimate as long as the band stays in the passband
+        b->factor = 1;
+        while (b->factor < STFT_MAX_DECIMATION
+                && b->resolution / (b->factor * 2) >= STFT_MIN_BAND_SIZE
+                && top <= DECIMATOR_PASSBAND * samplerate / (4 * b->factor)) {
+            b->factor *= 2;
+        }
+        b->size = b->resolution / b->factor;
+        b->scale = (sample_t)fft_size / b->size * fft_size / b->size;
+        res = stft_band_init (b, s->lanes, s->plan_flags);
+        if (res == 0) {
+            // the decimated samples are late by half the filter
+            size_t half = b->factor > 1 ? decimator_taps (b->decimator)/2 + b->factor : 0;
+            delay = MAX (delay, b->resolution/2 + half);
+            reach = MAX (reach, b->resolution/2 + half);
+        }
+    }
+    // reading starts up to a window, the filter and a decimation step before
+    // the common centre
+    reach += delay;
+    tmp.scratch = simd_malloc (sizeof (sample_t) * (fft_size + 2 * (delay + STFT_MAX_DECIMATION)));
+    tmp.power = simd_malloc (sizeof (sample_t) * bins);
+    if (res < 0 || !tmp.scratch || !tmp.power || reach > s->ring[0].size * 3/4) {
+        stft_free_bands (&tmp);
+        return -1;
+    }
+
+    if (s->cqt) {
+        cqt_free (s->cqt);
+        s->cqt = NULL;
+    }
+    stft_free_bands (s);
+    memcpy (s->band, tmp.band, sizeof (s->band));
+    s->bands = tmp.bands;
+    s->delay = delay;
+    s->reach = reach;
+    s->scratch = tmp.scratch;
+    s->power = tmp.power;
+    return 0;
+}
+
+int
+stft_bands (stft_t *s)
+{
+    return s->bands;
+}
+
+int
+stft_fft_size (stft_t *s)
+{
+    return s->fft_size;
+}
+
+int
+stft_lanes (stft_t *s)
+{
+    return s->lanes;
+}
+
+size_t
+stft_pending (stft_t *s)
+{
+    return ringbuf_write_pos (&s->ring[0]) - s->analysis_pos;
+}
+
+// bring the decimated history of a band up to the window centred delay
+// samples before end
+static int
+stft_decimate (stft_t *s, stft_band_t *b, size_t end)
+{
+    int n = b->size;
+    int factor = b->factor;
+    int taps = decimator_taps (b->decimator);
+    // outputs are aligned to the factor, so that they don't depend on the
+    // hop size
+    size_t last = (end - s->delay + b->resolution/2 + taps/2) / factor * factor;
+    size_t count = n;
+    if (b->history_valid && last - b->history_end < (size_t)n * factor) {
+        count = (last - b->history_end) / factor;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    size_t len = (count - 1) * factor + taps;
+    for (int l = 0; l < s->lanes; l++) {
+        sample_t *history = b->history + l * n;
+        if (ringbuf_read (&s->ring[l], s->scratch, last, len) < 0) {
+            b->history_valid = 0;
+            return -1;
+        }
+        memmove (history, history + count, sizeof (sample_t) * (n - count));
+        decimator_run (b->decimator, s->scratch, history + n - count, count);
+    }
+    b->history_end = last;
+    b->history_valid = 1;
+    return 0;
+}
+
+// the multi-resolution counterpart of stft_read
+static int
+stft_read_bands (stft_t *s, size_t end)
+{
+    if (end < s->reach) {
+        // not enough audio yet
+        return -1;
+    }
+    for (int i = 0; i < s->bands; i++) {
+        stft_band_t *b = &s->band[i];
+        int n = b->size;
+        if (b->decimator && stft_decimate (s, b, end) < 0) {
+            return -1;
+        }
+        for (int l = 0; l < s->lanes; l++) {
+            sample_t *in = b->in + l * n;
+            if (b->decimator) {
+                memcpy (in, b->history + l * n, sizeof (sample_t) * n);
+            }
+            else if (ringbuf_read (&s->ring[l], in, end - s->delay + n/2, n) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// copy the FFT windows ending at sample position end out of the rings
+static int
+stft_read (stft_t *s, size_t end)
+{
+    if (s->bands) {
+        return stft_read_bands (s, end);
+    }
+    int fft_size = s->fft_size;
+    for (int l = 0; l < s->lanes; l++) {
+        // lock-free: fails only if the producer lapped us while copying
+        if (ringbuf_read (&s->ring[l], s->in + l * fft_size, end, fft_size) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// window and transform what stft_read copied
+static void
+stft_transform (stft_t *s)
+{
+    for (int i = 0; i < s->bands; i++) {
+        stft_band_t *b = &s->band[i];
+        for (int l = 0; l < s->lanes; l++) {
+            kernels.window (b->in + l * b->size, b->window, b->size);
+        }
+        FFTW(execute) (b->plan);
+    }
+    if (s->bands) {
+        return;
+    }
+    // the constant-Q kernels are windowed already
+    if (!s->cqt) {
+        for (int l = 0; l < s->lanes; l++) {
+            kernels.window (s->in + l * s->fft_size, s->window, s->fft_size);
+        }
+    }
+    // all lanes at once
+    FFTW(execute) (s->plan);
+}
+
+int
+stft_pull (stft_t *s, int hop)
+{
+    if (!s->plan) {
+        return 0;
+    }
+    size_t end = ringbuf_write_pos (&s->ring[0]);
+    if (end - s->analysis_pos > s->ring[0].size - s->reach) {
+        // fell behind too far, the older audio is gone already
+        s->analysis_pos = end - hop;
+    }
+    while (s->analysis_pos + hop <= end) {
+        s->analysis_pos += hop;
+        if (stft_read (s, s->analysis_pos) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+stft_get_column (stft_t *s, sample_t *column)
+{
+    stft_transform (s);
+    int bins = s->fft_size/2;
+    for (int l = 0; l < s->lanes; l++) {
+        sample_t *lane = column + l * bins;
+        // every band fills its part of the column, coarser bins repeated
+        for (int i = 0; i < s->bands; i++) {
+            stft_band_t *b = &s->band[i];
+            int n = b->size;
+            int ratio = s->fft_size / b->resolution;
+            kernels.power (s->power, b->out + l * (n/2 + 1), n/2);
+            for (int g = b->lo; g < b->hi; g++) {
+                int k = MIN ((g + ratio/2) / ratio, n/2 - 1);
+                lane[g] = s->power[k] * b->scale;
+            }
+        }
+        if (s->bands) {
+            // nothing above the limit
+            int top = s->band[s->bands-1].hi;
+            memset (lane + top, 0, sizeof (sample_t) * (bins - top));
+            continue;
+        }
+        if (s->cqt) {
+            int n = cqt_bins (s->cqt);
+            cqt_transform (s->cqt, s->out + l * (bins + 1), lane);
+            memset (lane + n, 0, sizeof (sample_t) * (bins - n));
+        }
+        else {
+            kernels.power (lane, s->out + l * (bins + 1), bins);
+        }
+    }
+}
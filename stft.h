@@ -0,0 +1,153 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __STFT_H
+#define __STFT_H
+
+#include <stddef.h>
+
+#include "cqt.h"
+#include "decimator.h"
+#include "fft.h"
+#include "kernels.h"
+#include "ringbuf.h"
+
+// channels that can be analysed separately (7.1)
+#define STFT_MAX_LANES 8
+// frequency bands of the multi-resolution mode
+#define STFT_MAX_BANDS 3
+// decimation limit of the lower bands
+#define STFT_MAX_DECIMATION 16
+// smallest transform of a band
+#define STFT_MIN_BAND_SIZE 256
+
+// how stft_push turns the input channels into lanes
+enum {
+    // one lane, the channels mixed as selected by stft_mix_t.downmix
+    CHANNELS_MIX = 0,
+    // one lane per channel
+    CHANNELS_SEPARATE = 1,
+    // mid (L+R)/2 and side (L-R)/2 lanes
+    CHANNELS_MID_SIDE = 2,
+};
+
+typedef struct {
+    // CHANNELS_*
+    int mode;
+    // DOWNMIX_* and its channel (0 based), for CHANNELS_MIX
+    int downmix;
+    int channel;
+} stft_mix_t;
+
+/* Short-time Fourier transform of a live signal, the analysis half of the
+ * spectrogram without any GUI or player dependencies.
+ *
+ * Samples are pushed by one producer (the audio callback) without locking
+ * or waiting; they go into one ring per lane. One consumer pulls the power
+ * spectrum of every hop: the windows of all lanes are transformed by a
+ * single batched FFTW plan. The rings are sized for max_fft_size, so the
+ * consumer can change the FFT size and the lanes at any time without
+ * involving the producer.
+ *
+ * kernels_init should have been called before. */
+typedef struct stft_s stft_t;
+
+stft_t *
+stft_new (int max_fft_size);
+
+void
+stft_free (stft_t *s);
+
+// producer: append frames of interleaved float audio
+void
+stft_push (stft_t *s, const float *pcm, int frames, int channels, const stft_mix_t *mix);
+
+// lanes the producer currently fills
+int
+stft_input_lanes (stft_t *s);
+
+// consumer: (re)plan for fft_size and lanes, keeps the old setup and
+// returns -1 if that fails. Planning may take long, see fft.h. Turns the
+// constant-Q and multi-resolution modes off.
+int
+stft_configure (stft_t *s, int fft_size, int lanes, unsigned plan_flags);
+
+// consumer: constant-Q mode for the configured FFT size, see cqt.h, or
+// back to FFT bins with bins_per_octave 0. Keeps the old mode and returns
+// -1 if the kernels can't be made.
+int
+stft_set_cqt (stft_t *s, float samplerate, int bins_per_octave);
+
+/* consumer: multi-resolution and band-limited modes, or back to one FFT
+ * with no crossovers and no max_freq (0).
+ *
+ * The spectrum is split into up to STFT_MAX_BANDS bands at the crossover
+ * frequencies (ascending, in Hz). The lowest band has the resolution of
+ * the configured FFT size, every band above a quarter of the one below, so
+ * the highs are resolved in time rather than frequency. All bands read the
+ * same rings and their windows are centred on the same instant. Every band
+ * is decimated as far as its upper edge allows (see decimator.h) and
+ * transformed at the smaller size, which is what keeps the cost below
+ * that of one FFT of the full size.
+ *
+ * With max_freq nothing above it is analysed, the top band ends there and
+ * is decimated as well. Without crossovers that is a single band with the
+ * resolution of the configured FFT size at a fraction of its cost.
+ *
+ * The columns keep the layout of the configured FFT size: the bins of the
+ * coarser bands are repeated, the bins above max_freq are zero and all
+ * bands are scaled to the level of the full size FFT. The band plans use
+ * the planner flags given to stft_configure. Keeps the old mode and
+ * returns -1 on failure. */
+int
+stft_set_bands (stft_t *s, float samplerate, const float *crossovers, int num_crossovers, float max_freq);
+
+// bands in use, 0 if the mode is off
+int
+stft_bands (stft_t *s);
+
+// constant-Q bins per lane, 0 in FFT mode
+int
+stft_cqt_bins (stft_t *s);
+
+int
+stft_fft_size (stft_t *s);
+
+int
+stft_lanes (stft_t *s);
+
+// consumer: samples pushed since the last column
+size_t
+stft_pending (stft_t *s);
+
+// consumer: read the windows of the next hop out of the rings, returns 1
+// if there was one. If the consumer fell behind by more than the rings hold
+// it skips ahead.
+int
+stft_pull (stft_t *s, int hop);
+
+// consumer: window, transform and power spectra of the last pulled hop,
+// call it once per hop. fft_size/2 values per lane, lane l starts at
+// column + l*fft_size/2. In constant-Q mode only the first stft_cqt_bins
+// values of a lane are used, the rest is zero.
+void
+stft_get_column (stft_t *s, sample_t *column);
+
+#endif
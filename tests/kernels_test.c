@@ -0,0 +1,263 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Checks every SIMD kernel against the scalar reference, built and run by
+ * `make test`.
+ *
+ * All implementations kernels_get_available offers on this CPU get the same
+ * random input, with sizes that exercise the vector loops and the tails.
+ * The tolerances are what the kernels promise (see kernels.h):
+ *   window, power, downmix  the same arithmetic, relative REL_TOLERANCE
+ *   filterbank              summed in another order, FILTERBANK_TOLERANCE
+ *   db                      own log2, absolute DB_TOLERANCE in dB
+ *   color_index             exact for the same dB values
+ *   db + color_index        INDEX_TOLERANCE, the dB error moves values that
+ *                           are right at a step of the gradient
+ * Exits with a non-zero status if anything is outside. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../kernels.h"
+
+#define REL_TOLERANCE 1e-6
+#define FILTERBANK_TOLERANCE 1e-5
+#define DB_TOLERANCE 1e-4
+#define INDEX_TOLERANCE 1
+// random powers pushed through the dB and colour kernels
+#define POWERS (1 << 21)
+#define CHUNK 4096
+#define TABLE_SIZE 2048
+#define MAX_CHANNELS 6
+#define MAX_ROWS 512
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t
+rand_next (void)
+{
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// uniform in [lo, hi)
+static double
+rand_range (double lo, double hi)
+{
+    return lo + (hi - lo) * (rand_next () / 4294967296.0);
+}
+
+static int failures;
+
+static void
+fail (const kernels_t *k, const char *kernel, int i, double got, double want)
+{
+    if (failures++ < 20) {
+        fprintf (stderr, "kernels_test: %s %s [%d] is %.9g, scalar %.9g\n", k->name, kernel, i, got, want);
+    }
+}
+
+static void
+check_rel (const kernels_t *k, const char *kernel, int i, double got, double want, double tolerance)
+{
+    if (fabs (got - want) > tolerance * fmax (fabs (want), 1e-30)) {
+        fail (k, kernel, i, got, want);
+    }
+}
+
+// sizes around the vector widths and one long enough for the unrolled loops
+static const int sizes[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 47, 64, 100, 4093 };
+#define NUM_SIZES ((int)(sizeof (sizes) / sizeof (sizes[0])))
+
+static void
+test_window (const kernels_t *ref, const kernels_t *k)
+{
+    static sample_t buf[2][4096], window[4096];
+    for (int s = 0; s < NUM_SIZES; s++) {
+        int n = sizes[s];
+        for (int i = 0; i < n; i++) {
+            buf[0][i] = buf[1][i] = rand_range (-1, 1);
+            window[i] = rand_range (0, 1);
+        }
+        ref->window (buf[0], window, n);
+        k->window (buf[1], window, n);
+        for (int i = 0; i < n; i++) {
+            check_rel (k, "window", i, buf[1][i], buf[0][i], REL_TOLERANCE);
+        }
+    }
+}
+
+static void
+test_power (const kernels_t *ref, const kernels_t *k)
+{
+    static FFTW(complex) src[4096];
+    static sample_t dst[2][4096];
+    for (int s = 0; s < NUM_SIZES; s++) {
+        int n = sizes[s];
+        for (int i = 0; i < n; i++) {
+            src[i][0] = rand_range (-1000, 1000);
+            src[i][1] = rand_range (-1000, 1000);
+        }
+        ref->power (dst[0], src, n);
+        k->power (dst[1], src, n);
+        for (int i = 0; i < n; i++) {
+            check_rel (k, "power", i, dst[1][i], dst[0][i], REL_TOLERANCE);
+        }
+    }
+}
+
+static void
+test_downmix (const kernels_t *ref, const kernels_t *k)
+{
+    static float src[4096 * MAX_CHANNELS];
+    static sample_t dst[2][4096];
+    static const int channels[] = { 1, 2, 3, MAX_CHANNELS };
+    for (int c = 0; c < 4; c++) {
+        for (int mode = DOWNMIX_MEAN; mode <= DOWNMIX_CHANNEL; mode++) {
+            for (int s = 0; s < NUM_SIZES; s++) {
+                int n = sizes[s];
+                for (int i = 0; i < n * channels[c]; i++) {
+                    src[i] = rand_range (-1, 1);
+                }
+                int channel = rand_next () % MAX_CHANNELS;
+                ref->downmix (dst[0], src, n, channels[c], mode, channel);
+                k->downmix (dst[1], src, n, channels[c], mode, channel);
+                for (int i = 0; i < n; i++) {
+                    check_rel (k, "downmix", i, dst[1][i], dst[0][i], REL_TOLERANCE);
+                }
+            }
+        }
+    }
+}
+
+static void
+test_filterbank (const kernels_t *ref, const kernels_t *k)
+{
+    static sample_t src[4096];
+    static float weight[4096 * 8];
+    static int start[MAX_ROWS], offset[MAX_ROWS + 1];
+    static float dst[2][MAX_ROWS];
+    for (int i = 0; i < 4096; i++) {
+        src[i] = pow (10, rand_range (-8, 4));
+    }
+    // rows of every length up to a few vectors, anywhere in the spectrum
+    int size = 0;
+    for (int r = 0; r < MAX_ROWS; r++) {
+        int n = r < 80 ? r : 1 + rand_next () % 60;
+        start[r] = rand_next () % (4096 - n);
+        offset[r] = size;
+        for (int i = 0; i < n; i++) {
+            weight[size++] = rand_range (0, 1);
+        }
+    }
+    offset[MAX_ROWS] = size;
+    ref->filterbank (dst[0], src, start, offset, weight, MAX_ROWS);
+    k->filterbank (dst[1], src, start, offset, weight, MAX_ROWS);
+    for (int r = 0; r < MAX_ROWS; r++) {
+        check_rel (k, "filterbank", r, dst[1][r], dst[0][r], FILTERBANK_TOLERANCE);
+    }
+}
+
+// the powers of an FFT column, from far below the range to clipping, and
+// some exact zeros
+static void
+random_powers (float *power, int n)
+{
+    for (int i = 0; i < n; i++) {
+        power[i] = rand_next () % 64 == 0 ? 0 : (float)pow (10, rand_range (-16, 12));
+    }
+}
+
+static void
+test_db_color_index (const kernels_t *ref, const kernels_t *k, double *max_db_error, int *index_diffs)
+{
+    static float power[CHUNK], db[2][CHUNK];
+    static int32_t index[3][CHUNK];
+    static const float ranges[][2] = { { -10, 70 }, { 20, 120 }, { -50, 30 } };
+    for (int done = 0; done < POWERS; done += CHUNK) {
+        const float *range = ranges[(done / CHUNK) % 3];
+        int n = done % (8 * CHUNK) == 0 ? sizes[(done / CHUNK / 8) % NUM_SIZES] : CHUNK;
+        n = n > CHUNK ? CHUNK : n;
+        random_powers (power, n);
+        ref->db (db[0], power, n);
+        k->db (db[1], power, n);
+        for (int i = 0; i < n; i++) {
+            if (power[i] == 0) {
+                // -inf for the scalar version, far below any range for both
+                if (db[1][i] > -300) {
+                    fail (k, "db", i, db[1][i], db[0][i]);
+                }
+                continue;
+            }
+            double error = fabs (db[1][i] - db[0][i]);
+            *max_db_error = fmax (*max_db_error, error);
+            if (error > DB_TOLERANCE) {
+                fail (k, "db", i, db[1][i], db[0][i]);
+            }
+        }
+
+        // the same dB values give the same indices
+        ref->color_index (index[0], db[0], n, range[0], range[1], TABLE_SIZE);
+        k->color_index (index[1], db[0], n, range[0], range[1], TABLE_SIZE);
+        k->color_index (index[2], db[1], n, range[0], range[1], TABLE_SIZE);
+        for (int i = 0; i < n; i++) {
+            if (index[1][i] != index[0][i]) {
+                fail (k, "color_index", i, index[1][i], index[0][i]);
+            }
+            if (index[2][i] != index[0][i]) {
+                ++*index_diffs;
+                if (abs (index[2][i] - index[0][i]) > INDEX_TOLERANCE) {
+                    fail (k, "db+color_index", i, index[2][i], index[0][i]);
+                }
+            }
+        }
+    }
+}
+
+int
+main (void)
+{
+    const kernels_t *list[8];
+    int n = kernels_get_available (list, 8);
+    const kernels_t *ref = list[0];
+    for (int i = 1; i < n; i++) {
+        const kernels_t *k = list[i];
+        int before = failures;
+        double max_db_error = 0;
+        int index_diffs = 0;
+        test_window (ref, k);
+        test_power (ref, k);
+        test_downmix (ref, k);
+        test_filterbank (ref, k);
+        test_db_color_index (ref, k, &max_db_error, &index_diffs);
+        printf ("kernels_test: %-7s %s, max dB error %.2g, %d of %d gradient indices off by one\n",
+                k->name, failures == before ? "ok" : "FAILED", max_db_error, index_diffs, POWERS);
+    }
+    if (n == 1) {
+        printf ("kernels_test: only the scalar kernels are available\n");
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+/*
+    Spectrogram plugin for the DeaDBeeF audio player
+
+    Copyright (C) 2014 Christian Boxdörfer <christian.boxdoerfer@posteo.de>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+/* Stress test of the lock-free ring buffer, built and run by `make test`.
+ *
+ * A writer and a reader thread run at different, varying rates over many
+ * wraps of a small ring. Every sample holds its own absolute position, so a
+ * window that ringbuf_read accepts has to count up without gaps from its
+ * first to its last sample: anything else is a torn or reordered read. The
+ * reader falls behind on purpose now and then, the writer laps it and those
+ * reads have to fail instead. A single threaded part checks the overrun
+ * cases deterministically. Exits with a non-zero status on the first
+ * failure. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "../ringbuf.h"
+
+#define RING_SIZE 4096
+// samples of every read, a quarter of the ring like a large FFT
+#define WINDOW 1024
+#define MAX_CHUNK 700
+#define MAX_HOP 512
+#define TOTAL_SAMPLES ((size_t)1 << 26)
+// positions are stored modulo this, all of them are exact in a float
+#define VALUE_MASK 0xffffff
+
+typedef struct {
+    ringbuf_t rb;
+    int done;
+    size_t reads;
+    size_t overruns;
+    int failed;
+} stress_t;
+
+static uint32_t
+rand_next (uint32_t *state)
+{
+    // xorshift32
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static sample_t
+position_value (size_t pos)
+{
+    return (sample_t)(pos & VALUE_MASK);
+}
+
+static void
+pause_us (long us)
+{
+    struct timespec ts = { 0, us * 1000 };
+    nanosleep (&ts, NULL);
+}
+
+static void
+write_chunk (ringbuf_t *rb, size_t n)
+{
+    size_t pos = ringbuf_write_begin (rb, n);
+    for (size_t i = 0; i < n; i++) {
+        *ringbuf_slot (rb, pos + i) = position_value (pos + i);
+    }
+    ringbuf_write_commit (rb, n);
+}
+
+static void *
+writer_thread (void *ctx)
+{
+    stress_t *st = ctx;
+    uint32_t seed = 0x9e3779b9;
+    size_t written = 0;
+
+    while (written < TOTAL_SAMPLES && !__atomic_load_n (&st->failed, __ATOMIC_RELAXED)) {
+        size_t n = 1 + rand_next (&seed) % MAX_CHUNK;
+        write_chunk (&st->rb, n);
+        written += n;
+
+        // mostly flat out, with bursts and pauses like an audio callback
+        uint32_t r = rand_next (&seed) % 64;
+        if (r == 0) {
+            pause_us (50 + rand_next (&seed) % 200);
+        }
+        else if (r < 8) {
+            sched_yield ();
+        }
+    }
+    __atomic_store_n (&st->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int
+check_window (const sample_t *buffer, size_t end, size_t n)
+{
+    size_t start = end - n;
+    for (size_t i = 0; i < n; i++) {
+        if (buffer[i] != position_value (start + i)) {
+            fprintf (stderr, "ringbuf_stress: torn read, sample %zu of the window ending at %zu is %.0f, expected %.0f\n",
+                     i, end, (double)buffer[i], (double)position_value (start + i));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *
+reader_thread (void *ctx)
+{
+    stress_t *st = ctx;
+    uint32_t seed = 0x2545f491;
+    sample_t *buffer = simd_malloc (WINDOW * sizeof (sample_t));
+    if (!buffer) {
+        __atomic_store_n (&st->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    size_t cursor = WINDOW;
+    size_t last_write_pos = 0;
+    for (;;) {
+        int done = __atomic_load_n (&st->done, __ATOMIC_ACQUIRE);
+        size_t write_pos = ringbuf_write_pos (&st->rb);
+        if (write_pos < last_write_pos) {
+            fprintf (stderr, "ringbuf_stress: write position went back from %zu to %zu\n", last_write_pos, write_pos);
+            break;
+        }
+        last_write_pos = write_pos;
+
+        if (cursor > write_pos) {
+            if (done) {
+                free (buffer);
+                return NULL;
+            }
+            sched_yield ();
+            continue;
+        }
+
+        if (ringbuf_read (&st->rb, buffer, cursor, WINDOW) == 0) {
+            if (check_window (buffer, cursor, WINDOW) != 0) {
+                break;
+            }
+            st->reads++;
+            cursor += 1 + rand_next (&seed) % MAX_HOP;
+        }
+        else {
+            // lapped, skip to the newest window like the analysis thread
+            st->overruns++;
+            cursor = ringbuf_write_pos (&st->rb);
+            if (cursor < WINDOW) {
+                cursor = WINDOW;
+            }
+        }
+
+        // sometimes fall far enough behind to be lapped
+        if (rand_next (&seed) % 256 == 0) {
+            pause_us (100 + rand_next (&seed) % 400);
+        }
+    }
+
+    __atomic_store_n (&st->failed, 1, __ATOMIC_RELAXED);
+    free (buffer);
+    return NULL;
+}
+
+static int
+fail (const char *what)
+{
+    fprintf (stderr, "ringbuf_stress: %s\n", what);
+    return -1;
+}
+
+// overruns without a second thread, each read has to be refused
+static int
+check_overrun (void)
+{
+    ringbuf_t rb;
+    sample_t buffer[RING_SIZE];
+    if (ringbuf_init (&rb, RING_SIZE) != 0) {
+        return fail ("out of memory");
+    }
+
+    int res = -1;
+    write_chunk (&rb, RING_SIZE);
+    if (ringbuf_read (&rb, buffer, RING_SIZE, WINDOW) != 0
+        || check_window (buffer, RING_SIZE, WINDOW) != 0) {
+        fail ("read of a complete window failed");
+        goto out;
+    }
+    if (ringbuf_read (&rb, buffer, RING_SIZE + 1, WINDOW) != -1) {
+        fail ("read past the write position succeeded");
+        goto out;
+    }
+    if (ringbuf_read (&rb, buffer, RING_SIZE, RING_SIZE + 1) != -1) {
+        fail ("read larger than the ring succeeded");
+        goto out;
+    }
+
+    // the writer announces samples that overwrite the window, before and
+    // after publishing them
+    size_t end = RING_SIZE;
+    size_t n = RING_SIZE - WINDOW + 1;
+    size_t pos = ringbuf_write_begin (&rb, n);
+    if (ringbuf_read (&rb, buffer, end, WINDOW) != -1) {
+        fail ("read of a window being overwritten succeeded");
+        goto out;
+    }
+    for (size_t i = 0; i < n; i++) {
+        *ringbuf_slot (&rb, pos + i) = position_value (pos + i);
+    }
+    ringbuf_write_commit (&rb, n);
+    if (ringbuf_read (&rb, buffer, end, WINDOW) != -1) {
+        fail ("read of an overwritten window succeeded");
+        goto out;
+    }
+
+    // the newest window is still fine
+    end = ringbuf_write_pos (&rb);
+    if (ringbuf_read (&rb, buffer, end, WINDOW) != 0
+        || check_window (buffer, end, WINDOW) != 0) {
+        fail ("read of the newest window failed");
+        goto out;
+    }
+    res = 0;
+
+out:
+    ringbuf_free (&rb);
+    return res;
+}
+
+int
+main (void)
+{
+    if (check_overrun () != 0) {
+        return EXIT_FAILURE;
+    }
+
+    stress_t st = { .done = 0 };
+    if (ringbuf_init (&st.rb, RING_SIZE) != 0) {
+        fail ("out of memory");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t writer, reader;
+    if (pthread_create (&reader, NULL, reader_thread, &st) != 0) {
+        fail ("can't start the reader");
+        return EXIT_FAILURE;
+    }
+    if (pthread_create (&writer, NULL, writer_thread, &st) != 0) {
+        fail ("can't start the writer");
+        __atomic_store_n (&st.failed, 1, __ATOMIC_RELAXED);
+        __atomic_store_n (&st.done, 1, __ATOMIC_RELEASE);
+        pthread_join (reader, NULL);
+        return EXIT_FAILURE;
+    }
+    pthread_join (writer, NULL);
+    pthread_join (reader, NULL);
+    ringbuf_free (&st.rb);
+
+    if (st.failed) {
+        return EXIT_FAILURE;
+    }
+    if (st.reads == 0) {
+        fail ("no window was read");
+        return EXIT_FAILURE;
+    }
+    printf ("ringbuf_stress: %zu samples, %zu wraps, %zu windows read, %zu overruns refused\n",
+            TOTAL_SAMPLES, TOTAL_SAMPLES / RING_SIZE, st.reads, st.overruns);
+    return EXIT_SUCCESS;
+}